@@ -0,0 +1,19 @@
+; Allocation: build and drop many short lists so the nursery keeps
+; filling up, while a long-lived list survives into the old generation.
+
+(define (build n acc)
+    (if (= n 0) acc (build (- n 1) (cons n acc))))
+
+(define (drop n survivors)
+    (build n '())
+    survivors)
+
+(define (churn rounds survivors)
+    (if (= rounds 0)
+        (length survivors)
+        (churn (- rounds 1)
+               (if (= (modulo rounds 50) 0)
+                   (cons (build 20 '()) survivors)
+                   (drop 200 survivors)))))
+
+(writeln (churn 5000 '()))
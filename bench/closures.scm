@@ -0,0 +1,24 @@
+; Closures: create, pass around and call many small lambdas through
+; higher order functions.
+
+(define (make-adder n) (lambda (x) (+ x n)))
+
+(define (compose f g) (lambda (x) (f (g x))))
+
+(define (iota n acc)
+    (if (= n 0) acc (iota (- n 1) (cons n acc))))
+
+(define (apply-all fs x)
+    (if (null? fs) x (apply-all (cdr fs) ((car fs) x))))
+
+(define (run rounds acc)
+    (if (= rounds 0)
+        acc
+        (run (- rounds 1)
+             (+ acc (apply-all (map make-adder (iota 50 '()))
+                               ((compose (make-adder 1) (make-adder 2))
+                                rounds))))))
+
+(writeln (run 4000 0))
+(writeln (length (filter (lambda (x) (= (modulo x 3) 0))
+                         (map (lambda (x) (* x x)) (iota 20000 '())))))
@@ -0,0 +1,11 @@
+# Generates a large source file for the reader benchmark: many quoted
+# nested lists, strings, characters and symbols, bound and discarded.
+
+BEGIN {
+	count = count ? count : 20000
+	for (i = 0; i < count; i++) {
+		printf "(define item-%d '(%d \"string %d\" #\\x sym-%d", i, i, i, i
+		printf " (nested (list %d %d) #t #f) ((a . b) c)))\n", i, i * 7
+	}
+	printf "(writeln item-%d)\n", count - 1
+}
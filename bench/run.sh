@@ -0,0 +1,38 @@
+#!/bin/sh
+# Runs every benchmark in bench/ several times and prints one tab
+# separated line per run: name, run, wall clock milliseconds and the
+# collector summary from --gc-summary. The wall clock time is the last
+# field of that summary, measured by the interpreter itself, because
+# `date` can't portably give anything finer than seconds.
+#
+# usage: bench/run.sh [scheme binary] [extra scheme options...]
+
+SCHEME=${1:-./scheme}
+[ $# -gt 0 ] && shift
+RUNS=${BENCH_RUNS:-5}
+DIR=$(dirname "$0")
+TEMP=${TEMP_DIR:-temp}
+TAB=$(printf '\t')
+
+mkdir -p "$TEMP/bench"
+awk -f "$DIR/reader.awk" > "$TEMP/bench/reader.scm"
+
+printf "benchmark\trun\twall_ms\tallocated\tfreed\tminor\tmajor\tslices"
+printf "\tpeak_objects\tmark_ms\tsweep_ms\tmax_pause_ms\n"
+
+for file in "$DIR"/*.scm "$TEMP/bench/reader.scm"; do
+	name=$(basename "$file" .scm)
+	run=1
+	while [ $run -le "$RUNS" ]; do
+		"$SCHEME" --gc-summary "$@" "$file" \
+			> /dev/null 2> "$TEMP/bench-stats" || {
+			echo "$name failed:" >&2
+			cat "$TEMP/bench-stats" >&2
+			exit 1
+		}
+		stats=$(tail -n 1 "$TEMP/bench-stats")
+		printf "%s\t%d\t%s\t%s\n" "$name" $run \
+			"${stats##*$TAB}" "${stats%$TAB*}"
+		run=$((run + 1))
+	done
+done
@@ -0,0 +1,20 @@
+; String building: append through a string builder and through
+; string-append, then take the result apart again.
+
+(define (fill-builder sb n)
+    (if (= n 0)
+        (string-builder->string sb)
+        (fill-builder (string-builder-append! sb "abcdefgh") (- n 1))))
+
+(define (concat s n)
+    (if (= n 0) s (concat (string-append s "xy") (- n 1))))
+
+(define (count-chars xs ch acc)
+    (cond ((null? xs) acc)
+          ((eq? (car xs) ch) (count-chars (cdr xs) ch (+ acc 1)))
+          (else (count-chars (cdr xs) ch acc))))
+
+(define big (fill-builder (make-string-builder) 50000))
+(writeln (string-length big))
+(writeln (count-chars (string->list big) #\a 0))
+(writeln (string-length (concat "" 2000)))
@@ -0,0 +1,11 @@
+; Deep tail recursion: loops of millions of iterations that must run in
+; constant stack space, including mutual recursion.
+
+(define (count-down n acc)
+    (if (= n 0) acc (count-down (- n 1) (+ acc 1))))
+
+(define (my-even? n) (if (= n 0) #t (my-odd? (- n 1))))
+(define (my-odd? n) (if (= n 0) #f (my-even? (- n 1))))
+
+(writeln (count-down 1000000 0))
+(writeln (my-even? 500000))
@@ -44,7 +44,7 @@
 
 ; problem #6
 (define (palindrome? x)
-    (eq? x (reverse x)))
+    (equal? x (reverse x)))
 
 (writeln (palindrome? '(a b c d)))
 (writeln (palindrome? '(x a m a x)))
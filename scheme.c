@@ -93,11 +93,29 @@ int main(int argc, const char** argv)
 void execute(FILE*);
 void execute_file(const char* filename);
 void repl(void);
+int parse_options(int argc, const char** argv);
+void load_stdlib(void);
+
+extern int JOBS;
+void run_jobs(int count, const char** files);
+extern const char* SERVE_PATH;
+extern const char* CONNECT_PATH;
+void serve(const char* path);
+void send_to_server(const char* path, int count, const char** files);
 
 void do_useful_stuff(int argc, const char** argv)
 {
-	if (argc >= 2) {
-		for (int i = 1; i < argc; i++)
+	int first = parse_options(argc, argv);
+	if (CONNECT_PATH)
+		send_to_server(CONNECT_PATH, argc - first, argv + first);
+	load_stdlib();
+
+	if (SERVE_PATH) {
+		serve(SERVE_PATH);
+	} else if (argc - first > 1 && JOBS > 1) {
+		run_jobs(argc - first, argv + first);
+	} else if (argc > first) {
+		for (int i = first; i < argc; i++)
 			execute_file(argv[i]);
 	} else if (isatty(fileno(stdin))) {
 		repl();
@@ -111,6 +129,17 @@ void do_useful_stuff(int argc, const char** argv)
 // `./scheme foo.scm`, then execute a file; when it's started as `cat
 // foo.scm | ./scheme` do precisely the same, and otherwise fire up a REPL.
 //
+// Oh, and command line options (like `--gc-pause=500`) may come before the
+// file names. `parse_options()` deals with those and tells where the file
+// names begin, and I'll write it much later, once there are options to
+// speak of. The standard library gets loaded right after, since one of
+// those options (`--image=`) says where to load it from. And another one,
+// `--jobs=4`, runs the files four at a time, each in a fresh runtime of
+// its own. And `--serve=PATH` never runs anything by itself: it waits on a
+// socket for `./scheme --connect=PATH foo.scm` to hand it files (that one
+// waits for them to run and exits right there), so that the library is
+// loaded once rather than for every script.
+//
 // Now that I know that I'm going to have a function that reads code from a
 // stream and executes it, writing a function that does the same with a
 // file is trivial, so let's just make one.
@@ -120,12 +149,15 @@ void do_useful_stuff(int argc, const char** argv)
 #include <stdlib.h>
 #include <string.h>
 
+_Noreturn void die(void);
+
 #define DIE(fmt, ...)                                                          \
 	do {                                                                   \
 		fprintf(stderr, "[%s:%d] ", __FILE__, __LINE__);               \
 		fprintf(stderr, fmt, ##__VA_ARGS__);                           \
 		fprintf(stderr, "\n");                                         \
-		abort();                                                       \
+		fflush(stdout);                                                \
+		die();                                                         \
 	} while (0)
 
 FILE* fopen_or_die(const char* pathname, const char* mode)
@@ -137,8 +169,15 @@ FILE* fopen_or_die(const char* pathname, const char* mode)
 	DIE("Error opening file %s: %s", pathname, err);
 }
 
+#include <stdbool.h>
+
+bool execute_mapped(const char* filename);
+
 void execute_file(const char* filename)
 {
+	if (execute_mapped(filename))
+		return;
+
 	FILE* f = fopen_or_die(filename, "r");
 	execute(f);
 	fclose(f);
@@ -183,24 +222,25 @@ void execute_file(const char* filename)
 // Anyway, let's implement `execute()`
 //
 
-#include <stdbool.h>
-
 struct object;
 typedef struct object* object_t;
 
-void decref(object_t);
+int open_frame(void);
+void close_frame(int frame);
 
 object_t eval_repl(object_t);
 object_t read_object(FILE*);
+void compact_if_due(void);
 
 void execute(FILE* in)
 {
+	int frame = open_frame();
 	object_t expr;
 
 	while ((expr = read_object(in))) {
-		object_t result = eval_repl(expr);
-		decref(expr);
-		decref(result);
+		eval_repl(expr);
+		close_frame(frame);
+		compact_if_due();
 	}
 }
 
@@ -216,8 +256,9 @@ void execute(FILE* in)
 // that, respectively, read an object from an input stream and evaluate it
 // in REPL context.
 //
-// The last one is the `decref()` function that is needed because I'm going
-// to have automatic memory management. For this, I have three options:
+// The last ones are `open_frame()` and `close_frame()` that are needed
+// because I'm going to have automatic memory management. For this, I have
+// three options:
 //
 // 1. I can do reference counting. Very simple to do for as long as objects
 // don't form reference cycles, then it gets quirky.
@@ -231,8 +272,22 @@ void execute(FILE* in)
 //
 // From this simple function, it's already clear that whichever method I
 // choose must be able to deal with references from the C call stack.
-// Analyzing them in a pure tracing manner is pretty cumbersome, so I have
-// to count them anyway, and that's what `decref()` will do.
+// Analyzing them in a pure tracing manner is pretty cumbersome, since C
+// won't say which of the words on its stack are pointers. Counting them
+// is cumbersome too, only in a different way: every single time a C
+// function gets an object or is done with one, it has to say so.
+//
+// So I go with #2, but I let the C stack keep a list of its own. Every
+// object that C code gets hold of goes onto a stack of handles, and the
+// collector treats whatever is there as reachable. Handles are never
+// dropped one by one. Instead, a C function that's about to make a mess
+// opens a frame, and closing it drops every handle pushed since, all at
+// once. Here, each top level form gets a frame of its own, and once it's
+// evaluated, neither the form nor its value is needed anymore.
+//
+// (And `compact_if_due()` is there because the gap between two top level
+// forms is the one moment nothing is half done, and the garbage collector
+// may want to use it to tidy up. It's optional, and much, much later.)
 //
 // Now comes the REPL...
 //
@@ -241,15 +296,15 @@ void write_object(FILE*, object_t obj);
 
 void repl()
 {
+	int frame = open_frame();
 	object_t expr;
 
 	printf("> ");
 	while ((expr = read_object(stdin))) {
 		object_t result = eval_repl(expr);
-		decref(expr);
-
 		write_object(stdout, result);
-		decref(result);
+		close_frame(frame);
+		compact_if_due();
 
 		printf("\n> ");
 		fflush(stdout);
@@ -391,21 +446,41 @@ int fgetc_read_string(FILE* in)
 	return ch;
 }
 
-object_t wrap_string(const char*);
+object_t wrap_owned_string(char* value, int length);
+
+struct text {
+	char* data;
+	int length;
+	int capacity;
+};
+
+void reserve_text(struct text* text, int capacity)
+{
+	if (capacity <= text->capacity)
+		return;
+	text->data = realloc(text->data, capacity);
+	if (! text->data)
+		DIE("Out of memory");
+	text->capacity = capacity;
+}
+
+void append_char(struct text* text, char ch)
+{
+	if (text->length == text->capacity)
+		reserve_text(text, text->capacity ? text->capacity * 2 : 64);
+	text->data[text->length++] = ch;
+}
 
 object_t read_string(FILE* in)
 {
-	char buffer[10240];
-	int fill = 0, ch;
+	struct text text = {NULL, 0, 0};
+	int ch;
 
-	while ((ch = fgetc_read_string(in)) != EOF) {
-		buffer[fill++] = ch;
-		if (fill >= 10240)
-			DIE("Buffer overflow");
-	}
+	while ((ch = fgetc_read_string(in)) != EOF)
+		append_char(&text, ch);
 
-	buffer[fill] = '\0';
-	return wrap_string(buffer);
+	append_char(&text, '\0');
+	return wrap_owned_string(text.data, text.length - 1);
 }
 
 //
@@ -413,11 +488,12 @@ object_t read_string(FILE* in)
 // buffer until you reach the closing double quote, then wrap the contents
 // of the buffer into an `object_t` and call it a day.
 //
-// Yes, this simplistic implementation will miserably fail to parse a
-// source file with a string constant that is longer than 10K characters.
+// The first version of it collected them in a buffer of 10K on the stack,
+// and it would miserably fail to parse a source file with a string
+// constant any longer than that.
 //
 // And if you take some time to think about it, hard-coded 10K bytes for
-// buffer size is kind of interesting here. It's an arbitrary number that,
+// buffer size is kind of interesting. It's an arbitrary number that,
 // on the one hand, is safely above any practical limit in terms of
 // usefulness. I mean, of course, you can hard-code the entirety of "Crime
 // and Punishment" as a single string constant just to humiliate a dimwit
@@ -443,6 +519,10 @@ object_t read_string(FILE* in)
 // write a super-duper-sophisticated OS on such machine because **it just
 // won't fit**, but still, it's so cool.
 //
+// Anyway, a buffer that doubles whenever it fills up costs about as much
+// as a fixed one and has no limit to argue about, so that's what `struct
+// text` is now.
+//
 // Okay, back to business. Let's `parse_atom()`.
 //
 
@@ -472,7 +552,7 @@ int fgetc_read_atom(FILE* in)
 	return ch;
 }
 
-object_t parse_atom(const char*);
+object_t parse_atom(const char*, int len);
 object_t wrap_char(char ch);
 
 object_t read_character(FILE* in)
@@ -486,20 +566,21 @@ object_t read_character(FILE* in)
 
 object_t read_atom(FILE* in)
 {
-	char buffer[10240];
-	int fill = 0, ch;
-
-	while ((ch = fgetc_read_atom(in)) != EOF) {
-		buffer[fill++] = ch;
-		if (fill >= 10240)
-			DIE("Buffer overflow");
-	}
+	struct text text = {NULL, 0, 0};
+	int ch;
 
-	if ((fill == 2) && (buffer[0] == '#') && (buffer[1] == '\\'))
-		return read_character(in);
+	while ((ch = fgetc_read_atom(in)) != EOF)
+		append_char(&text, ch);
+	append_char(&text, '\0');
 
-	buffer[fill] = '\0';
-	return parse_atom(buffer);
+	int fill = text.length - 1;
+	object_t result;
+	if ((fill == 2) && (text.data[0] == '#') && (text.data[1] == '\\'))
+		result = read_character(in);
+	else
+		result = parse_atom(text.data, fill);
+	free(text.data);
+	return result;
 }
 
 //
@@ -542,40 +623,45 @@ object_t read_atom(FILE* in)
 
 object_t wrap_bool(bool v);
 
-object_t parse_bool(const char* text)
+bool is_token(const char* word, const char* text, int len)
+{
+	return (strncmp(word, text, len) == 0) && (word[len] == '\0');
+}
+
+object_t parse_bool(const char* text, int len)
 {
-	if (strcmp(text, "#f") == 0)
+	if (is_token("#f", text, len))
 		return wrap_bool(false);
-	if (strcmp(text, "#t") == 0)
+	if (is_token("#t", text, len))
 		return wrap_bool(true);
 	return NULL;
 }
 
-object_t parse_char(const char* text)
+object_t parse_char(const char* text, int len)
 {
-	if (strcmp(text, "#\\newline") == 0)
+	if (is_token("#\\newline", text, len))
 		return wrap_char('\n');
-	if (strcmp(text, "#\\space") == 0)
+	if (is_token("#\\space", text, len))
 		return wrap_char(' ');
-	if (strcmp(text, "#\\") == 0)
+	if (is_token("#\\", text, len))
 		return wrap_char(' ');
-	if ((strlen(text) == 3) && (text[0] == '#') && (text[1] == '\\'))
+	if ((len == 3) && (text[0] == '#') && (text[1] == '\\'))
 		return wrap_char(text[2]);
 	return NULL;
 }
 
 object_t wrap_int(int value);
 
-object_t parse_int(const char* text)
+object_t parse_int(const char* text, int len)
 {
 	int index = 0, digits = 0, accum = 0, sign = 1;
 
-	if (text[0] == '-') {
+	if ((len > 0) && (text[0] == '-')) {
 		index = 1;
 		sign = -1;
 	}
 
-	for (; text[index]; index++) {
+	for (; index < len; index++) {
 		if (! isdigit(text[index]))
 			return NULL;
 		accum = accum * 10 + (text[index] - '0');
@@ -586,17 +672,18 @@ object_t parse_int(const char* text)
 }
 
 object_t wrap_symbol(const char*);
+object_t intern_symbol(const char*, int len);
 
-object_t parse_atom(const char* buffer)
+object_t parse_atom(const char* text, int len)
 {
 	object_t result;
-	if ((result = parse_bool(buffer)))
+	if ((result = parse_bool(text, len)))
 		return result;
-	if ((result = parse_int(buffer)))
+	if ((result = parse_int(text, len)))
 		return result;
-	if ((result = parse_char(buffer)))
+	if ((result = parse_char(text, len)))
 		return result;
-	return wrap_symbol(buffer);
+	return intern_symbol(text, len);
 }
 
 //
@@ -606,6 +693,10 @@ object_t parse_atom(const char* buffer)
 // like a floating-point number... Convert it to a symbol because screw
 // you!
 //
+// (These take the text and its length rather than a zero-terminated
+// string, so that a token can be parsed right where it sits in the input
+// without being copied anywhere first.)
+//
 // To give a bit of a background here, this pet project of mine was never
 // intended to be a feature-complete standards-compliant Scheme
 // implementation. It started with solving some of "99 Lisp problems" and
@@ -653,14 +744,10 @@ object_t read_list(FILE* in)
 {
 	object_t accum = wrap_nil(), obj;
 
-	while ((obj = read_next_object(in))) {
+	while ((obj = read_next_object(in)))
 		push_to_list(&accum, obj);
-		decref(obj);
-	}
 
-	object_t result = reverse_read_list(accum);
-	decref(accum);
-	return result;
+	return reverse_read_list(accum);
 }
 
 //
@@ -684,9 +771,7 @@ object_t wrap_pair(object_t, object_t);
 
 void push_to_list(object_t* ptr, object_t head)
 {
-	object_t tail = *ptr;
-	*ptr = wrap_pair(head, tail);
-	decref(tail);
+	*ptr = wrap_pair(head, *ptr);
 }
 
 //
@@ -707,8 +792,6 @@ bool is_symbol(const char* text, object_t obj);
 
 object_t pop_from_list(object_t*);
 
-void incref(object_t);
-
 object_t reverse_read_list(object_t list)
 {
 	object_t result = wrap_nil(), obj;
@@ -720,10 +803,7 @@ object_t reverse_read_list(object_t list)
 		}
 
 		pair_t pair = assert_pair(result, "when parsing a list");
-		obj = car(pair);
-		incref(obj);
-		decref(result);
-		result = obj;
+		result = car(pair);
 	}
 
 	return result;
@@ -793,12 +873,7 @@ object_t read_quote(FILE* in)
 
 	object_t result = wrap_nil();
 	push_to_list(&result, obj);
-	decref(obj);
-
-	object_t keyword = wrap_symbol("quote");
-	push_to_list(&result, keyword);
-	decref(keyword);
-
+	push_to_list(&result, wrap_symbol("quote"));
 	return result;
 }
 
@@ -831,12 +906,13 @@ object_t read_quote(FILE* in)
 struct scope;
 typedef struct scope* scope_t;
 
-object_t eval_eager(scope_t scope, object_t expr);
+object_t eval_lazy(scope_t scope, object_t expr);
+object_t force_at_top_level(object_t value);
 scope_t get_repl_scope(void);
 
 object_t eval_repl(object_t expr)
 {
-	return eval_eager(get_repl_scope(), expr);
+	return force_at_top_level(eval_lazy(get_repl_scope(), expr));
 }
 
 //
@@ -852,6 +928,10 @@ object_t eval_repl(object_t expr)
 // evaluation* in the context of this story, I first have to elaborate on
 // the pragmatics for having all that in the first place.
 //
+// (And `force_at_top_level()` is the eager half of it, plus a moment for
+// the garbage collector to tidy up in the middle of a long computation.
+// That one's also much, much later.)
+//
 // So. Scheme is a functional programming language, and in functional
 // programming, people don't do loops, but instead, they do recursion. And
 // for infinite loops, they do, well, infinite recursion. And "infinite"
@@ -942,20 +1022,23 @@ typedef struct thunk* thunk_t;
 
 object_t eval_thunk(thunk_t thunk);
 thunk_t to_thunk(object_t obj);
+object_t close_frame_with(int frame, object_t result);
 
 object_t force(object_t value)
 {
+	int frame = open_frame();
 	thunk_t thunk;
 
-	while ((thunk = to_thunk(value))) {
-		object_t new_value = eval_thunk(thunk);
-		decref(value);
-		value = new_value;
-	}
+	while ((thunk = to_thunk(value)))
+		value = close_frame_with(frame, eval_thunk(thunk));
 
 	return value;
 }
 
+//
+// (Every round gets a frame of its own, and only what it comes up with is
+// kept to the next one. An infinite loop had better not pile up an
+// infinite number of handles.)
 //
 // You know, I've just realized it's the third time in this story when I
 // say, "I have three ways to deal with it," the previous two being
@@ -986,6 +1069,7 @@ symbol_t to_symbol(object_t);
 
 object_t eval_sexpr(scope_t, object_t head, object_t body);
 object_t eval_var(scope_t scope, symbol_t key);
+object_t eval_resolved(scope_t scope, object_t expr);
 
 object_t eval_lazy(scope_t scope, object_t expr)
 {
@@ -997,8 +1081,8 @@ object_t eval_lazy(scope_t scope, object_t expr)
 	if (sexpr)
 		return eval_sexpr(scope, car(sexpr), cdr(sexpr));
 
-	incref(expr);
-	return expr;
+	object_t result = eval_resolved(scope, expr);
+	return result ? result : expr;
 }
 
 //
@@ -1007,36 +1091,49 @@ object_t eval_lazy(scope_t scope, object_t expr)
 // otherwise just evaluate it to itself (so that `(eval "bla")` is simply
 // `"bla"`)
 //
+// Well, almost. Lambda bodies get analysed once when the lambda is
+// created, and that analysis swaps variable names for little objects that
+// already know where the variable lives. Those know how to evaluate
+// themselves, so they get a say before falling back to "evaluate to
+// itself."
+//
 
 object_t lookup_in_scope(scope_t scope, symbol_t key);
 const char* unwrap_symbol(symbol_t);
+object_t hold(object_t);
 
 object_t eval_var(scope_t scope, symbol_t key)
 {
 	object_t result = lookup_in_scope(scope, key);
 	if (! result)
 		DIE("Undefined variable %s", unwrap_symbol(key));
-	incref(result);
-	return result;
+	return hold(result);
 }
 
 //
 // Evaluating a variable is pretty much just look it up in the current
-// scope and `DIE()` if it's not there.
+// scope and `DIE()` if it's not there. The value gets a handle, because
+// the variable may well be `set!` to something else while the value is
+// still in use.
 //
 
 object_t eval_funcall(scope_t scope, object_t func, object_t exprs);
 object_t eval_syntax(scope_t scope, object_t syntax, object_t body);
 
+object_t eval_cached(scope_t scope, object_t head, object_t body);
+
 object_t eval_sexpr(scope_t scope, object_t head, object_t body)
 {
+	object_t cached = eval_cached(scope, head, body);
+	if (cached)
+		return cached;
+
 	object_t syntax_or_func = eval_eager(scope, head);
 
 	object_t result = eval_syntax(scope, syntax_or_func, body);
 	if (! result)
 		result = eval_funcall(scope, syntax_or_func, body);
 
-	decref(syntax_or_func);
 	return result;
 }
 
@@ -1078,6 +1175,12 @@ object_t eval_sexpr(scope_t scope, object_t head, object_t body)
 // If my little story is your first encounter with Lisp, I can imagine how
 // mind-blowing can this be. Let it sink in, take your time.
 //
+// (The `eval_cached()` bit up front is just a shortcut. Inside analysed
+// lambda bodies the head of a form is usually a global like `if` or
+// `car`, and those remember what they found the last time around, so the
+// "evaluate and look at it" part gets skipped until something is
+// redefined.)
+//
 
 struct lambda;
 typedef struct lambda* lambda_t;
@@ -1085,24 +1188,107 @@ typedef struct lambda* lambda_t;
 lambda_t to_lambda(object_t);
 
 object_t invoke(object_t, int, object_t*);
+object_t invoke_lazily(object_t, int, object_t*);
 object_t wrap_thunk(lambda_t, int, object_t*);
 
+#define ARG_CHUNK 1024
+
+struct arg_chunk {
+	struct arg_chunk* below;
+	struct arg_chunk* above;
+	int size;
+	int avail;
+	object_t items[];
+};
+
+_Thread_local struct arg_chunk* ARG_STACK = NULL;
+
+void free_arg_chunks(struct arg_chunk* chunk)
+{
+	while (chunk) {
+		struct arg_chunk* above = chunk->above;
+		free(chunk);
+		chunk = above;
+	}
+}
+
+// Chunks above the top one are kept around for the next deep call
+struct arg_chunk* grow_arg_stack(struct arg_chunk* chunk, int count)
+{
+	struct arg_chunk* above = chunk ? chunk->above : NULL;
+	if (above && (above->avail >= count))
+		return above;
+
+	free_arg_chunks(above);
+	int avail = count > ARG_CHUNK / 2 ? 2 * count : ARG_CHUNK;
+	above = malloc(sizeof(*above) + avail * sizeof(object_t));
+	*above = (struct arg_chunk){chunk, NULL, 0, avail};
+	if (chunk)
+		chunk->above = above;
+	return above;
+}
+
+object_t* reserve_args(int count)
+{
+	struct arg_chunk* chunk = ARG_STACK;
+	if (! chunk || (chunk->size + count > chunk->avail))
+		chunk = ARG_STACK = grow_arg_stack(chunk, count);
+
+	object_t* args = &chunk->items[chunk->size];
+	chunk->size += count;
+	return args;
+}
+
+// Adds an argument to the window on top, moving it to a bigger chunk if
+// this one is full; nothing can be pointing into it while it's being built
+object_t* push_arg(object_t* args, int argct, object_t value)
+{
+	struct arg_chunk* chunk = ARG_STACK;
+	if (chunk->size == chunk->avail) {
+		chunk->size -= argct;
+		object_t* moved = reserve_args(argct + 1);
+		memcpy(moved, args, argct * sizeof(object_t));
+		moved[argct] = value;
+		return moved;
+	}
+
+	chunk->items[chunk->size++] = value;
+	return args;
+}
+
+void release_args(int count)
+{
+	struct arg_chunk* chunk = ARG_STACK;
+	chunk->size -= count;
+	while ((chunk->size == 0) && chunk->below)
+		chunk = ARG_STACK = chunk->below;
+}
+
+void dispose_arg_stack(void)
+{
+	struct arg_chunk* chunk = ARG_STACK;
+	while (chunk && chunk->below)
+		chunk = chunk->below;
+	free_arg_chunks(chunk);
+	ARG_STACK = NULL;
+}
+
 object_t eval_funcall(scope_t scope, object_t func, object_t exprs)
 {
-	object_t args[64], expr;
+	int frame = open_frame();
+	object_t* args = reserve_args(0), expr;
 	int argct = 0;
 
 	while ((expr = pop_from_list(&exprs))) {
-		if (argct >= 64)
-			DIE("Buffer overflow");
-		args[argct++] = eval_eager(scope, expr);
+		object_t arg = eval_eager(scope, expr);
+		args = push_arg(args, argct++, arg);
 	}
 
 	lambda_t lambda = to_lambda(func);
-	if (lambda)
-		return wrap_thunk(lambda, argct, args);
-
-	return invoke(func, argct, args);
+	object_t result = lambda ? wrap_thunk(lambda, argct, args)
+				 : invoke_lazily(func, argct, args);
+	release_args(argct);
+	return close_frame_with(frame, result);
 }
 
 //
@@ -1124,10 +1310,20 @@ object_t eval_funcall(scope_t scope, object_t func, object_t exprs)
 // Scheme and require tail-call optimizations. This is done to separate
 // them from built-in functions, which are written in C and are supposed to
 // be hand-optimized, making lazy call overhead avoidable and unnecessary.
-//
-// 3. I cap the maximum number of arguments that a function may have at 64.
-// I even drafted a tirade to rationalize that... But I'm running out of
-// Chardonnay, so let's park it for now and move on to
+// The one exception is `apply`, which calls whatever it's given in tail
+// position, so what it returns can be a thunk too, and it's left to the
+// trampoline above like any other.
+//
+// 3. The buffer is not an array on the C stack, but a window into a stack
+// of its own. I used to cap the number of arguments at 64 and had a whole
+// tirade drafted to rationalize that, but it turned out to be cheaper to
+// just let that stack grow, a chunk at a time. A chunk never moves once
+// it's there, so a window stays put while the callee makes calls of its
+// own, and all a call costs is two bumps of a counter. The collector looks
+// through that stack as well, so once an argument is there, whatever it
+// took to compute it can go with this call's frame.
+//
+// And I'm running out of Chardonnay, so let's move on to
 // ## Chapter 4, where I finally write some code in Scheme
 //
 // Somewhere around Chapter 2, I mentioned that this whole story began with
@@ -1253,9 +1449,7 @@ object_t native_cdr(int argct, object_t* args) // cdr
 {
 	assert_arg_count("cdr", argct, 1);
 	pair_t pair = assert_pair(args[0], "as an argument #1 of cdr");
-	object_t result = cdr(pair);
-	incref(result);
-	return result;
+	return cdr(pair);
 }
 
 //
@@ -1318,9 +1512,7 @@ object_t native_car(int argct, object_t* args) // car
 {
 	assert_arg_count("car", argct, 1);
 	pair_t pair = assert_pair(args[0], "as an argument #1 of car");
-	object_t result = car(pair);
-	incref(result);
-	return result;
+	return car(pair);
 }
 
 //
@@ -1399,16 +1591,18 @@ typedef struct port* port_t;
 
 void assert_vararg_count(const char* name, int actual, int least, int most);
 port_t assert_port(object_t obj, const char* context);
+port_t assert_output_port(object_t obj, const char* context);
 FILE* unwrap_port(port_t);
+FILE* current_output(void);
 
 object_t native_write(int argct, object_t* args) // write
 {
 	assert_vararg_count("write", argct, 1, 2);
 
-	FILE* out = stdout;
+	FILE* out = current_output();
 	if (argct > 1) {
-		port_t port =
-			assert_port(args[1], "as an argument #2 of write");
+		port_t port = assert_output_port(args[1],
+						 "as an argument #2 of write");
 		out = unwrap_port(port);
 	}
 
@@ -1419,17 +1613,19 @@ object_t native_write(int argct, object_t* args) // write
 //
 // Nothing particularly spectacular here. "Port" is how they call a stream
 // (or a file handler or what have you) in Scheme. Oh, and it also can
-// accept one or two arguments. Aside from that, it's all straightforward.
+// accept one or two arguments. Without a port argument the output goes
+// to `current_output()`, which is plain `stdout` unless several runtimes
+// are running side by side. Aside from that, it's all straightforward.
 //
 
 object_t native_newline(int argct, object_t* args) // newline
 {
 	assert_vararg_count("newline", argct, 0, 1);
 
-	FILE* out = stdout;
+	FILE* out = current_output();
 	if (argct > 0) {
-		port_t port =
-			assert_port(args[0], "as an argument #2 of newline");
+		port_t port = assert_output_port(
+			args[0], "as an argument #2 of newline");
 		out = unwrap_port(port);
 	}
 
@@ -1452,10 +1648,7 @@ bool is_true(object_t);
 
 bool eval_boolean(scope_t scope, object_t code)
 {
-	object_t value = eval_eager(scope, code);
-	bool flag = is_true(value);
-	decref(value);
-	return flag;
+	return is_true(eval_eager(scope, code));
 }
 
 object_t syntax_if(scope_t scope, object_t code) // if
@@ -1515,7 +1708,6 @@ object_t syntax_define(scope_t scope, object_t code) // define
 	}
 
 	define(scope, key, value);
-	decref(value);
 	return wrap_nil();
 }
 
@@ -1546,7 +1738,6 @@ object_t syntax_quote(scope_t scope, object_t code) // quote
 {
 	object_t result = pop_from_list(&code);
 	ASSERT(result, "Malformed `quote`");
-	incref(result);
 	return result;
 }
 
@@ -1584,6 +1775,7 @@ void assert_vararg_count(const char* name, int actual, int least, int most)
 }
 
 port_t to_port(object_t);
+bool is_output_port(port_t);
 
 port_t assert_port(object_t obj, const char* context)
 {
@@ -1595,6 +1787,15 @@ port_t assert_port(object_t obj, const char* context)
 	DIE("Expected a port %s, got %s instead", context, typename(obj));
 }
 
+port_t assert_output_port(object_t obj, const char* context)
+{
+	port_t port = assert_port(obj, context);
+	if (! is_output_port(port))
+		DIE("Expected an output port %s, got an input port instead",
+		    context);
+	return port;
+}
+
 symbol_t assert_symbol(object_t obj, const char* context)
 {
 	symbol_t sym = to_symbol(obj);
@@ -1778,6 +1979,9 @@ enum gc_state {
 	REACHED,
 	REACHABLE,
 	GARBAGE,
+	REMEMBERED,
+	ON_STACK,
+	FORWARDED,
 };
 
 //
@@ -1791,45 +1995,68 @@ enum gc_state {
 // `GARBAGE` means this object is not reachable and (assuming we examined
 // all objects we have) can be safely disposed of.
 //
-// And then entire algorithm consists of three steps.
+// `REMEMBERED` means this object has been around long enough to be
+// considered old, but since then it was made to point to a young one. It
+// has to do with collecting garbage in generations, and I'll get to that
+// much later.
+//
+// `ON_STACK` means this object doesn't live on the heap at all, but in a
+// C function's local variable (or, in one case, a global one). The
+// collector never disposes of it, and reaches it on purpose rather than
+// by following pointers (that's for much later as well).
+//
+// `FORWARDED` means this object has been moved elsewhere, and it only
+// stays around long enough to say where to. Also for much later.
 //
+// And then entire algorithm consists of three steps (plus a bit of
+// bookkeeping to know how long they take).
+//
+
+#include <stdint.h>
 
 void mark_globally_reachable(void);
 void propagate_reachability(void);
 void dispose_garbage(void);
 
+uint64_t clock_nsec(void);
+void count_major_collection(uint64_t mark_nsec, uint64_t sweep_nsec);
+
 void collect_garbage()
 {
+	uint64_t start = clock_nsec();
 	mark_globally_reachable();
 	propagate_reachability();
+	uint64_t marked = clock_nsec();
 	dispose_garbage();
+	count_major_collection(marked - start, clock_nsec() - marked);
 }
 
 //
-// First, mark globally reachable objects as such.
+// First, mark globally reachable objects as such. "Globally" here means
+// "for this thread": every piece of runtime state is `_Thread_local`, so
+// each thread that calls `setup_runtime()` gets a heap of its own.
+//
+// Everything starts out as garbage, and then the roots, objects that
+// something on the C stack holds onto, get marked. Asking every object
+// whether it's a root would be a waste, so `mark_roots()` goes over the
+// handles and the few other places roots are kept instead (more on those
+// in the next chapter).
 //
 
-struct array ALL_OBJECTS;
-struct array REACHABLE_OBJECTS;
+_Thread_local struct array ALL_OBJECTS;
+_Thread_local struct array REACHABLE_OBJECTS;
 
-bool hasrefs(object_t);
 void set_gc_state(object_t, enum gc_state);
+void mark_roots(void);
 
 void mark_globally_reachable(void)
 {
 	REACHABLE_OBJECTS.size = 0;
 
-	for (int i = ALL_OBJECTS.size - 1; i >= 0; i--) {
-		object_t obj = ALL_OBJECTS.data[i];
-
-		if (! hasrefs(obj)) {
-			set_gc_state(obj, GARBAGE);
-			continue;
-		}
+	for (int i = 0; i < ALL_OBJECTS.size; i++)
+		set_gc_state(ALL_OBJECTS.data[i], GARBAGE);
 
-		set_gc_state(obj, REACHABLE);
-		push_to_array(&REACHABLE_OBJECTS, obj);
-	}
+	mark_roots();
 }
 
 //
@@ -1913,7 +2140,7 @@ void dispose_garbage(void)
 // Anyway, let's get objective and let's finally declare the `struct
 // object` that was defined back in the first chapter.
 //
-// So far, there are 41 functions (boy, that escalated quickly!) that I
+// So far, there are 42 functions (boy, that escalated quickly!) that I
 // promised to implement later, and they can be separated into five
 // categories:
 //
@@ -1921,8 +2148,9 @@ void dispose_garbage(void)
 // `cdr`, `define`, `eval_syntax`, `eval_thunk`, `is_nil`, `is_symbol`,
 // `is_true`, `to_*`s, `unwrap_*`s, `wrap_*`s.
 //
-// 2. Ones that have something to do with memory management: `decref`,
-// `hasrefs`, `incref`, `get_gc_state`, `set_gc_state`.
+// 2. Ones that have something to do with memory management:
+// `close_frame`, `close_frame_with`, `hold`, `open_frame`, `get_gc_state`,
+// `set_gc_state`.
 //
 // 3. Ones that are used to implement scoping mechanisms and/or to maintain
 // runtime environment in general: `define`, `get_repl_scope`,
@@ -1949,36 +2177,210 @@ struct type;
 typedef struct type* type_t;
 
 //
-// Now, for memory management, it's pretty evident that we need a counter
-// for stack references and an `enum gc_state` field for, well, GC state,
+// Now, for memory management, it's pretty evident that we need an `enum
+// gc_state` field for, well, GC state, and a counter of pins for the rare
+// C code that holds on to an object for good (I'll get to that in a bit),
 // which means we can (finally! hooray!) define `struct object`.
 //
 
 struct object {
 	type_t type;
-	unsigned stackrefs;
+	unsigned pins;
 	enum gc_state gc_state;
 };
 
 //
-// Functions for manipulating reference counter and GC state are as trivial
-// as it ever gets, so I'll just write them down.
+// Well, not every Scheme object has to be a `struct object` in memory. An
+// integer or a character is just a handful of bits, and doing `malloc()`
+// (and later garbage collecting the result) every time `length-impl` does
+// `(+ count 1)` is an awful lot of ceremony for so little. Heap objects
+// are always aligned to at least four bytes, which leaves two spare bits
+// at the bottom of every pointer, so I use those bits as a tag and keep
+// small values right inside the `object_t` itself.
+//
+
+#include <stdint.h>
+
+enum tag {
+	TAG_POINTER,
+	TAG_INT,
+	TAG_CHAR,
+	TAG_CONST,
+};
+
+enum constant {
+	CONST_NIL,
+	CONST_FALSE,
+	CONST_TRUE,
+	CONST_EOF,
+};
+
+#define TAG_BITS 2
+#define TAG_MASK ((uintptr_t)3)
+
+_Static_assert(sizeof(intptr_t) > sizeof(int),
+	       "an int must fit into a tagged pointer");
+
+object_t make_immediate(enum tag tag, intptr_t payload)
+{
+	return (object_t)(((uintptr_t)payload << TAG_BITS) | tag);
+}
+
+enum tag get_tag(object_t obj)
+{
+	return (uintptr_t)obj & TAG_MASK;
+}
+
+intptr_t immediate_payload(object_t obj)
+{
+	return (intptr_t)obj >> TAG_BITS;
+}
+
+bool is_immediate(object_t obj)
+{
+	return get_tag(obj) != TAG_POINTER;
+}
+
+//
+// Functions for manipulating handles and GC state are as trivial as it
+// ever gets, so I'll just write them down. Immediates don't live on the
+// heap, so there's nothing to hold for them, and neither does a scope
+// that lives on the C stack (that's for later), which the collector finds
+// on its own anyway.
+//
+// A frame is nothing but the height of the handle stack at the moment it
+// was opened, and closing it puts the height back. When one object (the
+// result, usually) has to outlive the frame, `close_frame_with()` gives it
+// a fresh handle in the frame below.
+//
+
+_Thread_local struct array HANDLES;
+_Thread_local int HANDLES_SCANNED;
+
+object_t hold(object_t obj)
+{
+	if (! is_immediate(obj) && obj->gc_state != ON_STACK)
+		push_to_array(&HANDLES, obj);
+	return obj;
+}
+
+int open_frame(void)
+{
+	return HANDLES.size;
+}
+
+void close_frame(int frame)
+{
+	HANDLES.size = frame;
+	if (HANDLES_SCANNED > frame)
+		HANDLES_SCANNED = frame;
+}
+
+object_t close_frame_with(int frame, object_t result)
+{
+	close_frame(frame);
+	return hold(result);
+}
+
+//
+// Some things hold on to an object for longer than any frame lasts,
+// though: the table of builtins, say, or the profiler. Those pin it
+// instead. An object with a nonzero pin counter is a root, and the
+// collector shouldn't have to look at every object to find the few pinned
+// ones, so the first `pin()` also puts an object on the list of `PINNED`.
+// The top bit of the counter says it's already there, so it's never
+// listed twice. Dropping back to zero doesn't take an object off the list
+// (that would mean searching it); instead, `mark_roots()` throws away such
+// entries before the collector gets to dispose of anything.
+//
+
+#define LISTED_PIN (1u << 31)
+
+_Thread_local struct array PINNED;
+
+bool is_pinned(object_t obj)
+{
+	return (obj->pins & ~LISTED_PIN) > 0;
+}
+
+void pin(object_t obj)
+{
+	if (is_immediate(obj) || obj->gc_state == ON_STACK)
+		return;
+	if (! obj->pins) {
+		obj->pins = LISTED_PIN;
+		push_to_array(&PINNED, obj);
+	}
+	obj->pins++;
+}
+
+void unpin(object_t obj)
+{
+	if (is_immediate(obj) || obj->gc_state == ON_STACK)
+		return;
+	ASSERT(is_pinned(obj), "unpin() without matching pin()");
+	obj->pins--;
+}
+
+//
+// Then the roots are whatever is pinned, whatever has a handle, scopes on
+// the C stack, and a few places where C code keeps objects in bulk, like
+// the arguments of the calls under way (those get to `visit_roots()` as
+// they're defined).
+//
+// Marking every handle after every few thousand allocations would be
+// wasteful when most of them haven't changed since the last time, though.
+// An object that had a handle back then has survived that collection, and
+// a collection of young objects only (which is much later) doesn't need
+// to look at it again. So `HANDLES_SCANNED` remembers how far that got,
+// and a frame closing below that mark lowers it.
 //
 
-void decref(object_t obj)
+void mark_reachable(object_t);
+void reach_scope(object_t);
+void visit_pending_call(void (*visit)(object_t));
+void visit_vm(void (*visit)(object_t));
+
+_Thread_local struct array STACK_SCOPES;
+
+void visit_roots(void (*visit)(object_t), int first_handle)
 {
-	ASSERT(obj->stackrefs > 0, "decref() without matching incref()");
-	obj->stackrefs--;
+	for (int i = first_handle; i < HANDLES.size; i++)
+		visit(HANDLES.data[i]);
+
+	for (struct arg_chunk* chunk = ARG_STACK; chunk; chunk = chunk->below)
+		for (int i = 0; i < chunk->size; i++)
+			visit(chunk->items[i]);
+
+	visit_pending_call(visit);
+	visit_vm(visit);
 }
 
-bool hasrefs(object_t obj)
+void mark_roots_from(int first_handle)
 {
-	return obj->stackrefs > 0;
+	int keep = 0;
+
+	for (int i = 0; i < STACK_SCOPES.size; i++)
+		reach_scope(STACK_SCOPES.data[i]);
+
+	for (int i = 0; i < PINNED.size; i++) {
+		object_t obj = PINNED.data[i];
+		if (is_pinned(obj)) {
+			PINNED.data[keep++] = obj;
+			mark_reachable(obj);
+		} else {
+			obj->pins &= ~LISTED_PIN;
+		}
+	}
+	PINNED.size = keep;
+
+	visit_roots(mark_reachable, first_handle);
+	HANDLES_SCANNED = HANDLES.size;
 }
 
-void incref(object_t obj)
+void mark_roots(void)
 {
-	obj->stackrefs++;
+	mark_roots_from(0);
 }
 
 enum gc_state get_gc_state(object_t obj)
@@ -2027,9 +2429,13 @@ struct type {
 	const char* name;
 	void (*display)(FILE*, object_t);
 	void (*dispose)(object_t);
+	object_t (*eval)(scope_t, object_t);
+	int id;
 	object_t (*invoke)(object_t func, int argc, object_t* args);
 	void (*label)(object_t obj, symbol_t label);
+	size_t (*measure)(object_t);
 	void (*reach)(object_t);
+	size_t size;
 	void (*write)(FILE*, object_t);
 };
 
@@ -2069,35 +2475,48 @@ struct type {
 // done in Haskell, where classes are *just slightly too cumbersome* to use
 // for cases where you don't actually need polymorphism.
 //
-// Anyway, now that we have a type marker let's write some functions.
+// Anyway, now that we have a type marker let's write some functions. Since
+// immediates don't carry a `type` field, I promise to figure out the type
+// of an arbitrary `object_t` once all the relevant types are defined.
 //
 
+type_t type_of(object_t);
+
 const char* typename(object_t obj)
 {
-	return obj->type->name;
+	return type_of(obj)->name;
 }
 
 //
 // Okay, this one is trivial.
 //
 
+void release_slot(void*, size_t);
+void count_disposal(type_t);
+
 void dispose(object_t obj)
 {
-	if (obj->type->dispose)
-		obj->type->dispose(obj);
-	free(obj);
+	type_t type = obj->type;
+	size_t size = type->measure ? type->measure(obj) : type->size;
+
+	if (type->dispose)
+		type->dispose(obj);
+	count_disposal(type);
+	release_slot(obj, size);
 }
 
 //
 // This one is also pretty self-explanatory. It also demonstrates how to
 // mark that the function doesn't do anything special by default, which is
-// simply by assigning the pointer to "NULL".
+// simply by assigning the pointer to "NULL". Most types have a fixed size,
+// but the ones that don't can say how big each particular object is.
 //
 
 void set_label(object_t obj, symbol_t label)
 {
-	if (obj->type->label)
-		obj->type->label(obj, label);
+	type_t type = type_of(obj);
+	if (type->label)
+		type->label(obj, label);
 }
 
 //
@@ -2105,25 +2524,27 @@ void set_label(object_t obj, symbol_t label)
 // one of an integer number, not so much.
 //
 
-void decref_many(int argct, object_t* args)
+object_t invoke_lazily(object_t func, int argct, object_t* args)
 {
-	for (int i = argct - 1; i >= 0; i--)
-		decref(args[i]);
+	type_t type = type_of(func);
+	if (! type->invoke)
+		DIE("Can't invoke object of type %s", typename(func));
+	int frame = open_frame();
+	object_t result = type->invoke(func, argct, args);
+	return close_frame_with(frame, result);
 }
 
 object_t invoke(object_t func, int argct, object_t* args)
 {
-	if (! func->type->invoke)
-		DIE("Can't invoke object of type %s", typename(func));
-	object_t result = func->type->invoke(func, argct, args);
-	decref_many(argct, args);
-	return result;
+	return force(invoke_lazily(func, argct, args));
 }
 
 //
-// Nothing special in this one except for `decref()`ing function arguments
-// that we (remember?!) have to do to mark they're not on call stack
-// anymore.
+// Nothing special in these except for the frame that (remember?!) drops
+// whatever the call got hold of once it's over, the result aside. Oh, and
+// `force()`ing the result: whoever calls `invoke()` wants a value, not a
+// promise of one. Only a call in tail position can do with the promise,
+// and that's what `invoke_lazily()` is for.
 //
 
 void reach(object_t obj)
@@ -2142,18 +2563,20 @@ void reach(object_t obj)
 
 void display_object(FILE* out, object_t obj)
 {
-	if (obj->type->display)
-		obj->type->display(out, obj);
+	type_t type = type_of(obj);
+	if (type->display)
+		type->display(out, obj);
 	else
 		write_object(out, obj);
 }
 
 void write_object(FILE* out, object_t obj)
 {
-	if (obj->type->write)
-		obj->type->write(out, obj);
+	type_t type = type_of(obj);
+	if (type->write)
+		type->write(out, obj);
 	else
-		fprintf(out, "[%s@%p]", obj->type->name, obj);
+		fprintf(out, "[%s@%p]", type->name, obj);
 }
 
 //
@@ -2167,17 +2590,36 @@ void write_object(FILE* out, object_t obj)
 // machinery (as well as triggers the garbage collection itself); it'll be
 // used in various `wrap_*()` functions.
 //
+// Most objects die young, so a new one doesn't go straight to
+// `ALL_OBJECTS` but to the nursery instead. Once the nursery is full, it's
+// collected on its own, survivors are moved to `ALL_OBJECTS`, and only
+// when that grows too big does the full collection kick in.
+//
+
+#define NURSERY_SIZE 4096
+
+_Thread_local struct array NURSERY;
+
+void collect_nursery(void);
+bool register_incrementally(object_t);
 
 void register_object(object_t obj)
 {
-	static int threshold = 100;
+	static _Thread_local int threshold = 100;
 
-	if (ALL_OBJECTS.size > threshold) {
-		collect_garbage();
-		threshold = ALL_OBJECTS.size * 2;
+	if (register_incrementally(obj))
+		return;
+
+	if (NURSERY.size >= NURSERY_SIZE) {
+		collect_nursery();
+		if (ALL_OBJECTS.size > threshold) {
+			collect_garbage();
+			threshold = ALL_OBJECTS.size * 2;
+		}
 	}
 
-	push_to_array(&ALL_OBJECTS, obj);
+	obj->gc_state = GARBAGE;
+	push_to_array(&NURSERY, obj);
 }
 
 //
@@ -2187,7 +2629,7 @@ void register_object(object_t obj)
 
 void mark_reachable(object_t obj)
 {
-	if (! obj)
+	if (! obj || is_immediate(obj))
 		return;
 
 	if (obj->gc_state == GARBAGE) {
@@ -2196,6 +2638,25 @@ void mark_reachable(object_t obj)
 	}
 }
 
+//
+// A field that may point to a pair goes through `reach_field()` instead,
+// which gets the field itself rather than what's in it. Usually that's
+// the same thing, but the collector can also be asked to move pairs
+// around, and then every such field has to learn the new address.
+//
+
+_Thread_local bool COMPACTING;
+
+object_t evacuate(object_t);
+
+void reach_field(object_t* field)
+{
+	if (COMPACTING)
+		*field = evacuate(*field);
+	else
+		mark_reachable(*field);
+}
+
 //
 // And with these functions written down, it's a good time to wrap up, but
 // only to continue in
@@ -2217,6 +2678,8 @@ void mark_reachable(object_t obj)
 struct string {
 	struct object self;
 	char* value;
+	int length;
+	int capacity;
 };
 
 typedef struct string* string_t;
@@ -2253,7 +2716,7 @@ typedef struct string* string_t;
 void display_string(FILE* out, object_t obj)
 {
 	string_t str = (string_t)obj;
-	fputs(str->value, out);
+	fwrite(str->value, 1, str->length, out);
 }
 
 void dispose_string(object_t obj)
@@ -2295,25 +2758,45 @@ struct type TYPE_STRING = {
 
 #include <strings.h>
 
+void* alloc_slot(size_t);
+void count_allocation(type_t, size_t);
+
 void* alloc_object(const type_t type, size_t size)
 {
-	object_t obj = malloc(size);
+	object_t obj = alloc_slot(size);
+	bzero(obj, size);
+	count_allocation(type, size);
 	obj->type = type;
-	obj->stackrefs = 1;
 	register_object(obj);
-	return obj;
+	return hold(obj);
 }
 
 object_t wrap_string(const char* v)
 {
 	string_t str = alloc_object(&TYPE_STRING, sizeof(*str));
 	str->value = strdup(v);
+	str->length = strlen(v);
+	str->capacity = str->length;
 	return (object_t)str;
 }
 
 //
 // Yeah, it's pretty dull, just allocating a structure and populating it
-// with exactly what you'd expect.
+// with exactly what you'd expect. The length is remembered so that nobody
+// has to walk the string to find its end, and the capacity says how much
+// room is in the buffer, which matters for strings that get built up bit
+// by bit.
+//
+// Nothing points to a new object yet, so it gets a handle straight away,
+// but only once the collector knows about it: registering may run a
+// collection, and a handle that collection has seen is one the next minor
+// collection takes as scanned already.
+//
+// The memory itself comes from `alloc_slot()` that hands out fixed-size
+// slots from per-size pools, which I'll get to later. The type remembers
+// how big its objects are, so that `dispose()` knows which pool to give
+// the slot back to, and `count_allocation()` keeps tally of how many of
+// them were made.
 //
 // Okay, we're done with strings. Now lets's make what's perhaps the most
 // iconic Lisp data type of all, the Mighty Pair.
@@ -2347,8 +2830,8 @@ object_t cdr(pair_t pair)
 void reach_pair(object_t obj)
 {
 	pair_t pair = (pair_t)obj;
-	mark_reachable(pair->car);
-	mark_reachable(pair->cdr);
+	reach_field(&pair->car);
+	reach_field(&pair->cdr);
 }
 
 //
@@ -2357,24 +2840,37 @@ void reach_pair(object_t obj)
 
 void write_pair(FILE* out, object_t obj)
 {
-	pair_t pair = (pair_t)obj;
+	struct array rests;
+	init_array(&rests);
+	fputc('(', out);
 
-	fputs("(", out);
+	while (true) {
+		pair_t pair = (pair_t)obj;
+		if (to_pair(car(pair))) {
+			push_to_array(&rests, cdr(pair));
+			fputc('(', out);
+			obj = car(pair);
+			continue;
+		}
 
-	while (pair) {
 		write_object(out, car(pair));
-
 		obj = cdr(pair);
-		if ((pair = to_pair(obj)))
-			fputs(" ", out);
-	}
 
-	if (! is_nil(obj)) {
-		fputs(" . ", out);
-		write_object(out, obj);
-	}
+		while (! to_pair(obj)) {
+			if (! is_nil(obj)) {
+				fputs(" . ", out);
+				write_object(out, obj);
+			}
+			fputc(')', out);
 
-	fputs(")", out);
+			if (rests.size == 0) {
+				dispose_array(&rests);
+				return;
+			}
+			obj = pop_from_array(&rests);
+		}
+		fputc(' ', out);
+	}
 }
 
 //
@@ -2382,6 +2878,11 @@ void write_pair(FILE* out, object_t obj)
 // construct lists, and lists should be represented appropriately, i.e.
 // `(write (cons 'a (cons 'b ())))` should produce `(a b)`.
 //
+// And lists nest, sometimes very deeply, so rather than calling itself
+// for every list inside a list, `write_pair()` keeps the rest of each
+// outer list it's in the middle of on a stack of its own, and gets back
+// to it once the inner one is closed.
+//
 
 struct type TYPE_PAIR = {
 	.name = "pair",
@@ -2403,7 +2904,7 @@ object_t wrap_pair(object_t head, object_t tail)
 
 pair_t to_pair(object_t obj)
 {
-	if (obj->type == &TYPE_PAIR)
+	if (type_of(obj) == &TYPE_PAIR)
 		return (pair_t)obj;
 	return NULL;
 }
@@ -2447,20 +2948,24 @@ pair_t to_pair(object_t obj)
 // Or else you can skip all that bureaucratic dreck, and then your life
 // gets, well, significantly more adventurous.
 //
-// And to illustrate this statement, I'm going to implement `integer_t`.
+// And to illustrate this statement, I'm going to implement integers.
 //
 
-struct integer {
-	struct object self;
-	int value;
-};
-
-typedef struct integer* integer_t;
-
 void write_int(FILE* out, object_t obj)
 {
-	integer_t num = (integer_t)obj;
-	fprintf(out, "%d", num->value);
+	char digits[24];
+	char* pos = digits + sizeof(digits);
+	long value = immediate_payload(obj);
+	unsigned long magnitude = value < 0 ? -(unsigned long)value : value;
+
+	do {
+		*--pos = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude);
+	if (value < 0)
+		*--pos = '-';
+
+	fwrite(pos, 1, digits + sizeof(digits) - pos, out);
 }
 
 struct type TYPE_INT = {
@@ -2470,32 +2975,32 @@ struct type TYPE_INT = {
 
 object_t wrap_int(int v)
 {
-	integer_t num = alloc_object(&TYPE_INT, sizeof(*num));
-	num->value = v;
-	return (object_t)num;
+	return make_immediate(TAG_INT, v);
+}
+
+// Counters can outgrow an int; those print fine, but `unbox_int()` won't
+// take them, so arithmetic on one dies instead of quietly wrapping around
+object_t wrap_long(long v)
+{
+	return make_immediate(TAG_INT, v);
 }
 
 //
-// Yep, nothing to write home about. Let's do `char_t`.
+// Yep, nothing to write home about. There isn't even a `struct` to
+// allocate, the number is simply shifted into the pointer bits. Printing
+// it doesn't need all the machinery of `fprintf()` either, spelling the
+// digits out back to front is enough. Let's do characters.
 //
 
-struct character {
-	struct object self;
-	char value;
-};
-
-typedef struct character* char_t;
-
 void display_char(FILE* out, object_t obj)
 {
-	char_t ch = (char_t)obj;
-	fputc(ch->value, out);
+	fputc((char)immediate_payload(obj), out);
 }
 
 void write_char(FILE* out, object_t obj)
 {
-	char_t ch = (char_t)obj;
-	switch (ch->value) {
+	char ch = immediate_payload(obj);
+	switch (ch) {
 	case '\n':
 		fputs("#\\newline", out);
 		break;
@@ -2503,7 +3008,7 @@ void write_char(FILE* out, object_t obj)
 		fputs("#\\space", out);
 		break;
 	default:
-		fprintf(out, "#\\%c", ch->value);
+		fprintf(out, "#\\%c", ch);
 	}
 }
 
@@ -2520,9 +3025,7 @@ struct type TYPE_CHAR = {
 
 object_t wrap_char(char v)
 {
-	char_t ch = alloc_object(&TYPE_CHAR, sizeof(*ch));
-	ch->value = v;
-	return (object_t)ch;
+	return make_immediate(TAG_CHAR, (unsigned char)v);
 }
 
 //
@@ -2532,6 +3035,9 @@ object_t wrap_char(char v)
 struct port {
 	struct object self;
 	FILE* value;
+	char* buffer;
+	size_t size;
+	bool output;
 };
 
 FILE* unwrap_port(port_t port)
@@ -2539,10 +3045,16 @@ FILE* unwrap_port(port_t port)
 	return port->value;
 }
 
+bool is_output_port(port_t port)
+{
+	return port->output;
+}
+
 void dispose_port(object_t obj)
 {
 	port_t port = (port_t)obj;
 	fclose(port->value);
+	free(port->buffer);
 }
 
 struct type TYPE_PORT = {
@@ -2554,12 +3066,15 @@ struct object* wrap_file(FILE* v)
 {
 	port_t port = alloc_object(&TYPE_PORT, sizeof(*port));
 	port->value = v;
+	port->buffer = NULL;
+	port->size = 0;
+	port->output = false;
 	return &port->self;
 }
 
 port_t to_port(object_t obj)
 {
-	if (obj->type == &TYPE_PORT)
+	if (type_of(obj) == &TYPE_PORT)
 		return (port_t)obj;
 	return NULL;
 }
@@ -2578,20 +3093,14 @@ struct type TYPE_NIL = {
 	.write = write_nil,
 };
 
-struct object NIL = {
-	.type = &TYPE_NIL,
-};
-
 object_t wrap_nil(void)
 {
-	object_t obj = &NIL;
-	incref(obj);
-	return obj;
+	return make_immediate(TAG_CONST, CONST_NIL);
 }
 
 bool is_nil(object_t obj)
 {
-	return obj == &NIL;
+	return obj == wrap_nil();
 }
 
 //
@@ -2601,7 +3110,9 @@ bool is_nil(object_t obj)
 // so it's natural to implement it as a constant without a data structure
 // to accompany it.
 //
-// Now let's do the same for booleans.
+// Now let's do the same for booleans, and for the end-of-file marker
+// that the reading functions return once a port runs dry. It has to be
+// something of its own: a file may well contain `()`.
 //
 
 void write_bool(FILE* out, object_t obj);
@@ -2611,17 +3122,14 @@ struct type TYPE_BOOL = {
 	.write = write_bool,
 };
 
-struct object TRUE = {
-	.type = &TYPE_BOOL,
-};
-
-struct object FALSE = {
-	.type = &TYPE_BOOL,
-};
+object_t wrap_bool(bool v)
+{
+	return make_immediate(TAG_CONST, v ? CONST_TRUE : CONST_FALSE);
+}
 
 bool is_false(object_t obj)
 {
-	return obj == &FALSE;
+	return obj == wrap_bool(false);
 }
 
 bool is_true(object_t obj)
@@ -2636,37 +3144,73 @@ bool is_true(object_t obj)
 
 void write_bool(FILE* out, object_t obj)
 {
-	fputs(obj == &TRUE ? "#t" : "#f", out);
+	fputs(obj == wrap_bool(true) ? "#t" : "#f", out);
 }
 
-object_t wrap_bool(bool v)
+void write_eof(FILE* out, object_t obj)
 {
-	object_t obj = v ? &TRUE : &FALSE;
-	incref(obj);
-	return obj;
+	fputs("#<eof>", out);
 }
 
-//
-// And now it's time to end this chapter and begin
-// ## Chapter 8, where I reinvent one more wheel
-// CUTOFF
-//
-
-struct symbol {
-	struct object self;
-	const char* value;
-	unsigned int hash;
+struct type TYPE_EOF = {
+	.name = "eof",
+	.write = write_eof,
 };
 
-void write_symbol(FILE* out, object_t obj)
+object_t wrap_eof(void)
 {
-	symbol_t symbol = (symbol_t)obj;
-	fprintf(out, "%s", symbol->value);
+	return make_immediate(TAG_CONST, CONST_EOF);
 }
 
-void dispose_symbol(object_t obj)
+bool is_eof(object_t obj)
 {
-	symbol_t symbol = (symbol_t)obj;
+	return obj == wrap_eof();
+}
+
+//
+// And with all the immediate types in place, I can keep the promise from
+// the previous chapter and tell the type of any `object_t`, tagged or not.
+//
+
+type_t type_of(object_t obj)
+{
+	switch (get_tag(obj)) {
+	case TAG_INT:
+		return &TYPE_INT;
+	case TAG_CHAR:
+		return &TYPE_CHAR;
+	case TAG_CONST:
+		if (immediate_payload(obj) == CONST_NIL)
+			return &TYPE_NIL;
+		if (immediate_payload(obj) == CONST_EOF)
+			return &TYPE_EOF;
+		return &TYPE_BOOL;
+	default:
+		return obj->type;
+	}
+}
+
+//
+// And now it's time to end this chapter and begin
+// ## Chapter 8, where I reinvent one more wheel
+// CUTOFF
+//
+
+struct symbol {
+	struct object self;
+	const char* value;
+	unsigned int hash;
+};
+
+void write_symbol(FILE* out, object_t obj)
+{
+	symbol_t symbol = (symbol_t)obj;
+	fprintf(out, "%s", symbol->value);
+}
+
+void dispose_symbol(object_t obj)
+{
+	symbol_t symbol = (symbol_t)obj;
 	free((char*)symbol->value);
 }
 
@@ -2686,7 +3230,7 @@ bool is_symbol(const char* text, object_t obj)
 
 symbol_t to_symbol(object_t obj)
 {
-	if (obj->type == &TYPE_SYMBOL)
+	if (type_of(obj) == &TYPE_SYMBOL)
 		return (symbol_t)obj;
 	return NULL;
 }
@@ -2726,105 +3270,101 @@ void dispose_dict(dict_t dict)
 
 //
 
-unsigned strhash(const char* key)
+unsigned strhash(const char* key, int len)
 {
-	unsigned result = 0;
-	while (*key)
-		result = result * 7 + *(key++);
+	unsigned result = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		result ^= (unsigned char)key[i];
+		result *= 16777619u;
+	}
 	return result;
 }
 
 //
 
 scope_t get_symbol_pool(void);
+symbol_t find_interned(const char* text, int len, unsigned hash);
 
 object_t wrap_symbol(const char* text)
 {
-	scope_t pool = get_symbol_pool();
-	int hash = strhash(text);
+	return intern_symbol(text, strlen(text));
+}
 
-	struct symbol tmp = {
-		.value = text,
-		.hash = hash,
-	};
+object_t intern_symbol(const char* text, int len)
+{
+	scope_t pool = get_symbol_pool();
+	unsigned hash = strhash(text, len);
 
-	object_t result = lookup_in_scope(pool, &tmp);
-	if (result) {
-		incref(result);
-		return result;
-	}
+	symbol_t sym = find_interned(text, len, hash);
+	if (sym)
+		return (object_t)sym;
 
-	symbol_t sym = alloc_object(&TYPE_SYMBOL, sizeof(*sym));
-	sym->value = strdup(text);
+	sym = alloc_object(&TYPE_SYMBOL, sizeof(*sym));
+	sym->value = strndup(text, len);
 	sym->hash = hash;
-	result = (object_t)sym;
-	bind_to_scope(pool, sym, result);
-	return result;
+	bind_to_scope(pool, sym, (object_t)sym);
+	return (object_t)sym;
 }
 
 //
 
-int compare_symbols(symbol_t, symbol_t);
 void enlarge_dict(dict_t);
 
+dict_entry_t probe_dict(dict_t dict, symbol_t key)
+{
+	unsigned mask = dict->size - 1;
+	for (unsigned index = key->hash;; index++) {
+		dict_entry_t entry = &dict->data[index & mask];
+		if (entry->key == NULL || entry->key == key)
+			return entry;
+	}
+}
+
 object_t put_in_dict(struct dict* dict, symbol_t key, object_t value)
 {
 	if ((dict->size == 0) || (dict->used * 2 > dict->size))
 		enlarge_dict(dict);
 
-	for (unsigned int index = key->hash;; index++) {
-		dict_entry_t entry = &dict->data[index % dict->size];
+	dict_entry_t entry = probe_dict(dict, key);
+	if (entry->key == NULL) {
+		entry->key = key;
+		entry->value = value;
+		dict->used++;
+		return NULL;
+	}
 
-		if (entry->key == NULL) {
-			entry->key = key;
-			entry->value = value;
-			dict->used++;
-			return NULL;
-		}
+	object_t result = entry->value;
+	entry->value = value;
+	return result;
+}
 
-		int diff = compare_symbols(entry->key, key);
-		if (diff == 0) {
-			object_t result = entry->value;
-			entry->value = value;
-			return result;
-		}
+dict_entry_t find_in_dict(dict_t dict, symbol_t sym)
+{
+	if (dict->size == 0)
+		return NULL;
 
-		if (diff > 0) {
-			struct dict_entry tmp = *entry;
-			entry->key = key;
-			entry->value = value;
-			key = tmp.key;
-			value = tmp.value;
-		}
-	}
+	dict_entry_t entry = probe_dict(dict, sym);
+	return entry->key ? entry : NULL;
 }
 
-//
-
-int compare_symbols(symbol_t a, symbol_t b)
+object_t lookup_in_dict(dict_t dict, symbol_t sym)
 {
-	if (a->hash < b->hash)
-		return -1;
-	if (a->hash > b->hash)
-		return 1;
-	return strcmp(a->value, b->value);
+	dict_entry_t entry = find_in_dict(dict, sym);
+	return entry ? entry->value : NULL;
 }
 
-object_t lookup_in_dict(dict_t dict, symbol_t sym)
+symbol_t find_symbol(dict_t dict, const char* text, int len, unsigned hash)
 {
 	if (dict->size == 0)
 		return NULL;
 
-	for (unsigned index = sym->hash;; index++) {
-		dict_entry_t entry = &dict->data[index % dict->size];
-		if (entry->key == NULL)
-			return NULL;
-
-		int diff = compare_symbols(entry->key, sym);
-		if (diff == 0)
-			return entry->value;
-		if (diff > 0)
+	unsigned mask = dict->size - 1;
+	for (unsigned index = hash;; index++) {
+		symbol_t key = dict->data[index & mask].key;
+		if (key == NULL)
 			return NULL;
+		if (key->hash == hash && is_token(key->value, text, len))
+			return key;
 	}
 }
 
@@ -2855,32 +3395,94 @@ void reach_dict(dict_t dict)
 {
 	for (int i = dict->size - 1; i >= 0; i--)
 		if (dict->data[i].key)
-			mark_reachable(dict->data[i].value);
+			reach_field(&dict->data[i].value);
 }
 
 //
 // ## Chapter 9
 //
 
+struct template {
+	struct object self;
+	object_t params;
+	object_t body;
+	object_t code;
+	struct array args;
+	symbol_t rest;
+	struct array names;
+	int* ops;
+	int opct;
+	int opcap;
+	struct array constants;
+	bool compiled;
+};
+
+typedef struct template* template_t;
+
 struct scope {
 	struct object self;
-	struct dict binds;
 	scope_t parent;
+	template_t template;
+	object_t* slots;
+	struct dict binds;
 };
 
+#include <stddef.h>
+
+#define FRAME_HEADER offsetof(struct scope, binds)
+
+object_t* find_slot(scope_t scope, symbol_t key)
+{
+	template_t template = scope->template;
+	if (template)
+		for (int i = 0; i < template->names.size; i++)
+			if (template->names.data[i] == (object_t)key)
+				return &scope->slots[i];
+	return NULL;
+}
+
+void write_barrier(object_t container, object_t old, object_t value);
+
+_Thread_local unsigned int BINDINGS_VERSION = 0;
+_Thread_local unsigned int GLOBAL_SETS = 0;
+
 void bind_to_scope(scope_t scope, symbol_t key, object_t value)
 {
+	object_t* slot = find_slot(scope, key);
+	if (slot) {
+		if (*slot)
+			DIE("%s is already defined", unwrap_symbol(key));
+		write_barrier((object_t)scope, NULL, value);
+		*slot = value;
+		return;
+	}
+
+	if (scope->template)
+		DIE("%s is not a local of this frame", unwrap_symbol(key));
+
+	write_barrier((object_t)scope, NULL, (object_t)key);
+	write_barrier((object_t)scope, NULL, value);
 	object_t ptr = put_in_dict(&scope->binds, key, value);
-	if (ptr != NULL) {
+	bool toplevel = (scope == get_repl_scope());
+	if (ptr != NULL && ! toplevel) {
 		const char* strkey = unwrap_symbol(key);
 		DIE("%s is already defined", strkey);
 	}
+	if (toplevel)
+		BINDINGS_VERSION++;
 }
 
 object_t lookup_in_scope(scope_t scope, symbol_t key)
 {
 	while (scope) {
-		object_t value = lookup_in_dict(&scope->binds, key);
+		object_t value;
+		if (scope->template) {
+			object_t* slot = find_slot(scope, key);
+			value = slot ? *slot : NULL;
+		} else {
+			value = lookup_in_dict(&scope->binds, key);
+		}
+
 		if (value)
 			return value;
 		scope = scope->parent;
@@ -2890,24 +3492,32 @@ object_t lookup_in_scope(scope_t scope, symbol_t key)
 
 scope_t derive_scope(scope_t parent);
 
+_Thread_local scope_t REPL_SCOPE = NULL;
+_Thread_local scope_t SYMBOL_POOL = NULL;
+
 scope_t get_repl_scope()
 {
-	static scope_t repl_scope = NULL;
-
-	if (repl_scope == NULL)
-		repl_scope = derive_scope(NULL);
+	if (REPL_SCOPE == NULL) {
+		REPL_SCOPE = derive_scope(NULL);
+		pin((object_t)REPL_SCOPE);
+	}
 
-	return repl_scope;
+	return REPL_SCOPE;
 }
 
 scope_t get_symbol_pool(void)
 {
-	static scope_t pool = NULL;
+	if (SYMBOL_POOL == NULL) {
+		SYMBOL_POOL = derive_scope(NULL);
+		pin((object_t)SYMBOL_POOL);
+	}
 
-	if (pool == NULL)
-		pool = derive_scope(NULL);
+	return SYMBOL_POOL;
+}
 
-	return pool;
+symbol_t find_interned(const char* text, int len, unsigned hash)
+{
+	return find_symbol(&get_symbol_pool()->binds, text, len, hash);
 }
 
 void reach_scope(object_t obj)
@@ -2937,9 +3547,69 @@ scope_t derive_scope(scope_t parent)
 	return scope;
 }
 
+//
+// A scope that lives on the C stack is the same thing, only it has to be
+// reached by the collector explicitly, for as long as it's there. It
+// never gets a handle (`hold()` knows to skip it), since a handle could
+// easily outlast it.
+//
+
+void enter_stack_scope(scope_t scope, scope_t parent)
+{
+	*scope = (struct scope){
+		.self = {.type = &TYPE_SCOPE, .gc_state = ON_STACK},
+		.parent = parent,
+	};
+	push_to_array(&STACK_SCOPES, (object_t)scope);
+}
+
+void leave_stack_scope(scope_t scope)
+{
+	pop_from_array(&STACK_SCOPES);
+	dispose_dict(&scope->binds);
+}
+
+void assert_on_heap(scope_t scope)
+{
+	ASSERT(! scope || scope->self.gc_state != ON_STACK,
+	       "A lambda closed over a scope on the stack");
+}
+
+void reach_frame(object_t obj)
+{
+	scope_t frame = (scope_t)obj;
+	mark_reachable((object_t)frame->parent);
+	mark_reachable((object_t)frame->template);
+	for (int i = frame->template->names.size - 1; i >= 0; i--)
+		reach_field(&frame->slots[i]);
+}
+
+size_t measure_frame(object_t obj)
+{
+	scope_t frame = (scope_t)obj;
+	return FRAME_HEADER + frame->template->names.size * sizeof(object_t);
+}
+
+struct type TYPE_FRAME = {
+	.name = "frame",
+	.measure = measure_frame,
+	.reach = reach_frame,
+};
+
+scope_t derive_frame(scope_t parent, template_t template)
+{
+	size_t size = FRAME_HEADER + template->names.size * sizeof(object_t);
+	scope_t frame = alloc_object(&TYPE_FRAME, size);
+	frame->parent = parent;
+	frame->template = template;
+	frame->slots = (object_t*)((char*)frame + FRAME_HEADER);
+	return frame;
+}
+
 struct native {
 	struct object self;
 	object_t (*invoke)(int, object_t*);
+	const char* name;
 };
 
 typedef struct native* native_t;
@@ -2955,21 +3625,48 @@ struct type TYPE_NATIVE = {
 	.invoke = invoke_native,
 };
 
+//
+// Every native and syntax also goes into `BUILTINS` under its name, which
+// is how images refer to them: an index would silently pick the wrong
+// function once the list of builtins changes from one build to the next.
+//
+
+_Thread_local struct dict BUILTINS;
+
+void register_builtin(const char* name, object_t obj)
+{
+	object_t key = wrap_symbol(name);
+	if (put_in_dict(&BUILTINS, (symbol_t)key, obj))
+		DIE("Builtin %s registered twice", name);
+	pin(obj);
+}
+
+void release_builtins(void)
+{
+	for (int i = 0; i < BUILTINS.size; i++) {
+		dict_entry_t entry = &BUILTINS.data[i];
+		if (entry->key)
+			unpin(entry->value);
+	}
+	dispose_dict(&BUILTINS);
+}
+
 void register_native(const char* name, object_t (*func)(int, object_t*))
 {
 	native_t native = alloc_object(&TYPE_NATIVE, sizeof(*native));
 	native->invoke = func;
+	native->name = name;
+	register_builtin(name, (object_t)native);
 
 	object_t key = wrap_symbol(name);
 
 	define(get_repl_scope(), (symbol_t)key, (object_t)native);
-	decref((object_t)native);
-	decref(key);
 }
 
 struct syntax {
 	struct object self;
 	object_t (*eval)(scope_t, object_t);
+	const char* name;
 };
 
 typedef struct syntax* syntax_t;
@@ -2989,17 +3686,21 @@ struct type TYPE_SYNTAX = {
 	.name = "syntax",
 };
 
-void register_syntax(const char* name, object_t (*func)(scope_t, object_t))
+syntax_t wrap_syntax(const char* name, object_t (*func)(scope_t, object_t))
 {
-	object_t key = wrap_symbol(name);
-
 	syntax_t syntax = alloc_object(&TYPE_SYNTAX, sizeof(*syntax));
 	syntax->eval = func;
+	syntax->name = name;
+	register_builtin(name, (object_t)syntax);
+	return syntax;
+}
 
-	define(get_repl_scope(), (symbol_t)key, (object_t)syntax);
+void register_syntax(const char* name, object_t (*func)(scope_t, object_t))
+{
+	object_t key = wrap_symbol(name);
+	syntax_t syntax = wrap_syntax(name, func);
 
-	decref((object_t)syntax);
-	decref(key);
+	define(get_repl_scope(), (symbol_t)key, (object_t)syntax);
 }
 
 struct lambda {
@@ -3008,14 +3709,58 @@ struct lambda {
 	scope_t scope;
 	symbol_t label;
 	struct array params;
+	symbol_t rest;
+	template_t template;
 };
 
+array_t lambda_params(lambda_t lambda)
+{
+	if (lambda->template)
+		return &lambda->template->args;
+	return &lambda->params;
+}
+
+symbol_t lambda_rest(lambda_t lambda)
+{
+	if (lambda->template)
+		return lambda->template->rest;
+	return lambda->rest;
+}
+
+//
+// A lambda whose parameter list ends in a dot, like `(lambda (x . rest)
+// ...)`, or is a lone symbol, like `(lambda args ...)`, takes any number
+// of arguments past the named ones, and gets those as a list. The list is
+// made right out of the argument window, so that's the one and only time
+// the extra arguments get consed.
+//
+
+#include <limits.h>
+
+object_t wrap_list(int count, object_t* items)
+{
+	object_t result = wrap_nil();
+	for (int i = count - 1; i >= 0; i--)
+		push_to_list(&result, items[i]);
+	return result;
+}
+
+void assert_arity(const char* name, int argct, int fixed, symbol_t rest)
+{
+	if (rest)
+		assert_vararg_count(name, argct, fixed, INT_MAX);
+	else
+		assert_arg_count(name, argct, fixed);
+}
+
 void reach_lambda(object_t obj)
 {
 	lambda_t lambda = (lambda_t)obj;
-	mark_reachable(lambda->body);
+	reach_field(&lambda->body);
 	mark_reachable((object_t)lambda->scope);
 	mark_reachable((object_t)lambda->label);
+	mark_reachable((object_t)lambda->rest);
+	mark_reachable((object_t)lambda->template);
 	for (int i = lambda->params.size - 1; i >= 0; i--)
 		mark_reachable(lambda->params.data[i]);
 }
@@ -3028,42 +3773,80 @@ void dispose_lambda(object_t obj)
 
 object_t eval_block(scope_t, object_t);
 
+object_t invoke_template(lambda_t lambda, int argct, object_t* args);
+
+_Thread_local bool PROFILING = false;
+void profile_enter(lambda_t lambda);
+void profile_leave(void);
+
+object_t invoke_body(lambda_t lambda, int argct, object_t* args);
+object_t rest_list(int count, object_t* items);
+
 object_t invoke_lambda(object_t obj, int argct, object_t* args)
 {
 	lambda_t lambda = (lambda_t)obj;
+	if (! PROFILING)
+		return invoke_body(lambda, argct, args);
+
+	profile_enter(lambda);
+	object_t result = invoke_body(lambda, argct, args);
+	profile_leave();
+	return result;
+}
+
+object_t invoke_body(lambda_t lambda, int argct, object_t* args)
+{
+	if (lambda->template)
+		return invoke_template(lambda, argct, args);
+
 	struct array* params = &lambda->params;
 	const char* name = lambda->label ? unwrap_symbol(lambda->label) : NULL;
 
-	assert_arg_count(name, argct, params->size);
+	assert_arity(name, argct, params->size, lambda->rest);
 
 	scope_t scope = derive_scope(lambda->scope);
 
 	for (int i = 0; i < params->size; i++)
 		define(scope, (symbol_t)params->data[i], args[i]);
-	object_t result = eval_block(scope, lambda->body);
-
-	decref((object_t)scope);
-	return result;
+	if (lambda->rest) {
+		int count = argct - params->size;
+		object_t rest = rest_list(count, &args[params->size]);
+		define(scope, lambda->rest, rest);
+	}
+	return eval_block(scope, lambda->body);
 }
 
 void label_lambda(object_t obj, symbol_t label)
 {
 	lambda_t lambda = (lambda_t)obj;
-	if (! lambda->label)
+	if (! lambda->label) {
+		write_barrier(obj, NULL, (object_t)label);
 		lambda->label = label;
+	}
 }
 
 void write_lambda(FILE* out, object_t ptr)
 {
 	lambda_t lambda = (lambda_t)ptr;
+	array_t params = lambda_params(lambda);
+	symbol_t rest = lambda_rest(lambda);
 
-	fputs("(lambda (", out);
-	for (int i = 0; i < lambda->params.size; i++) {
-		if (i > 0)
-			fputc(' ', out);
-		write_object(out, lambda->params.data[i]);
+	fputs("(lambda ", out);
+	if (rest && ! params->size) {
+		write_object(out, (object_t)rest);
+	} else {
+		fputc('(', out);
+		for (int i = 0; i < params->size; i++) {
+			if (i > 0)
+				fputc(' ', out);
+			write_object(out, params->data[i]);
+		}
+		if (rest) {
+			fputs(" . ", out);
+			write_object(out, (object_t)rest);
+		}
+		fputc(')', out);
 	}
-	fputc(')', out);
 	object_t body = lambda->body, obj;
 
 	while ((obj = pop_from_list(&body))) {
@@ -3085,24 +3868,39 @@ struct type TYPE_LAMBDA = {
 
 lambda_t to_lambda(object_t obj)
 {
-	if (obj->type == &TYPE_LAMBDA)
+	if (type_of(obj) == &TYPE_LAMBDA)
 		return (lambda_t)obj;
 	return NULL;
 }
 
+struct layout;
+
+template_t analyze_lambda(struct layout*, object_t params, object_t body);
+object_t instantiate(scope_t scope, template_t template);
+
 object_t wrap_lambda(scope_t scope, object_t params, object_t body)
 {
+	if (scope == get_repl_scope()) {
+		template_t template = analyze_lambda(NULL, params, body);
+		if (template)
+			return instantiate(scope, template);
+	}
+
+	assert_on_heap(scope);
 	lambda_t lambda = alloc_object(&TYPE_LAMBDA, sizeof(*lambda));
 	lambda->body = body;
 	lambda->scope = scope;
 	lambda->label = NULL;
 	init_array(&lambda->params);
 
-	object_t param;
-	while ((param = pop_from_list(&params))) {
+	pair_t cell;
+	for (; (cell = to_pair(params)); params = cdr(cell)) {
+		object_t param = car(cell);
 		assert_symbol(param, "function argument");
 		push_to_array(&lambda->params, param);
 	}
+	if (! is_nil(params))
+		lambda->rest = assert_symbol(params, "rest argument");
 
 	return (object_t)lambda;
 }
@@ -3112,8 +3910,7 @@ object_t eval_block(scope_t scope, object_t code)
 	object_t result = wrap_nil(), expr;
 
 	while ((expr = pop_from_list(&code))) {
-		result = force(result);
-		decref(result);
+		force(result);
 		result = eval_lazy(scope, expr);
 	}
 
@@ -3124,142 +3921,4944 @@ struct thunk {
 	struct object self;
 	lambda_t lambda;
 	int argct;
+	int avail;
 	object_t* args;
+	object_t spread;
+	int spread_at;
 };
 
-void thunk_dispose(object_t obj)
-{
-	thunk_t thunk = (thunk_t)obj;
-	free(thunk->args);
-}
-
-void thunk_reach(object_t obj)
-{
-	thunk_t thunk = (thunk_t)obj;
-	mark_reachable((object_t)thunk->lambda);
-	for (int i = thunk->argct - 1; i >= 0; i--)
-		mark_reachable(thunk->args[i]);
-}
-
 struct type TYPE_THUNK = {
 	.name = "thunk",
-	.reach = thunk_reach,
-	.dispose = thunk_dispose,
+};
+
+_Thread_local struct thunk PENDING_CALL = {
+	.self = {.type = &TYPE_THUNK, .gc_state = ON_STACK},
 };
 
 object_t wrap_thunk(lambda_t lambda, int argct, object_t* args)
 {
-	thunk_t thunk = alloc_object(&TYPE_THUNK, sizeof(*thunk));
+	thunk_t thunk = &PENDING_CALL;
+	ASSERT(! thunk->lambda, "A pending call was never forced");
+
+	if (argct > thunk->avail) {
+		int avail = argct > 2 * thunk->avail ? argct : 2 * thunk->avail;
+		thunk->args = realloc(thunk->args, avail * sizeof(*args));
+		if (! thunk->args)
+			DIE("Out of memory");
+		thunk->avail = avail;
+	}
 
-	size_t sz = argct * sizeof(object_t);
 	thunk->lambda = lambda;
 	thunk->argct = argct;
-	thunk->args = malloc(sz);
-	memcpy(thunk->args, args, sz);
-	decref_many(argct, args);
+	thunk->spread = NULL;
+	if (argct)
+		memcpy(thunk->args, args, argct * sizeof(object_t));
 
 	return (object_t)thunk;
 }
 
-object_t eval_thunk(thunk_t thunk)
+// Until it's forced, nothing but the pending call knows what it's got
+void visit_pending_call(void (*visit)(object_t))
 {
-	return invoke_lambda(
-		(object_t)thunk->lambda, thunk->argct, thunk->args);
+	thunk_t thunk = &PENDING_CALL;
+	if (! thunk->lambda)
+		return;
+
+	visit((object_t)thunk->lambda);
+	for (int i = 0; i < thunk->argct; i++)
+		visit(thunk->args[i]);
+	if (thunk->spread)
+		visit(thunk->spread);
 }
 
-thunk_t to_thunk(object_t obj)
+//
+// A call that `apply` leaves pending took its last few arguments from a
+// list, and a rest parameter would only build the very same list out of
+// them again. So the pending call remembers where that list went, and once
+// the arguments are in a window of their own, `SPREAD` says which part of
+// the window it was. `rest_list()` then hands over what's left of the
+// list instead of a copy, if that's exactly what a rest parameter asks
+// for. Only the very next binding gets to look, though: the window is
+// reused once the call is over.
+//
+
+_Thread_local struct spread {
+	object_t* items;
+	int count;
+	object_t list;
+} SPREAD;
+
+object_t rest_list(int count, object_t* items)
 {
-	if (obj->type == &TYPE_THUNK)
-		return (thunk_t)obj;
-	return NULL;
+	struct spread spread = SPREAD;
+	SPREAD.list = NULL;
+
+	object_t* end = spread.items + spread.count;
+	if (! spread.list || items < spread.items || items + count != end)
+		return wrap_list(count, items);
+
+	object_t list = spread.list;
+	for (object_t* at = spread.items; at < items; at++)
+		list = cdr((pair_t)list);
+	return list;
 }
 
-void register_builtins(void);
+object_t eval_thunk(thunk_t thunk)
+{
+	lambda_t lambda = thunk->lambda;
+	int argct = thunk->argct;
+	object_t* args = reserve_args(argct);
 
-void setup_runtime()
+	if (argct)
+		memcpy(args, thunk->args, argct * sizeof(object_t));
+	if (thunk->spread) {
+		int at = thunk->spread_at;
+		SPREAD = (struct spread){&args[at], argct - at, thunk->spread};
+		hold(thunk->spread);
+	}
+	thunk->lambda = NULL;
+	thunk->argct = 0;
+	thunk->spread = NULL;
+	hold((object_t)lambda);
+
+	object_t result = invoke_lambda((object_t)lambda, argct, args);
+	SPREAD.list = NULL;
+	release_args(argct);
+	return result;
+}
+
+thunk_t to_thunk(object_t obj)
 {
-	init_array(&ALL_OBJECTS);
-	init_array(&REACHABLE_OBJECTS);
-	register_builtins();
-	execute_file("stdlib.scm");
+	if (obj == &PENDING_CALL.self)
+		return &PENDING_CALL;
+	return NULL;
 }
 
 //
 
-void teardown_runtime()
+object_t eval_resolved(scope_t scope, object_t expr)
 {
-	decref((object_t)get_repl_scope());
-	decref((object_t)get_symbol_pool());
-	collect_garbage();
-	dispose_array(&ALL_OBJECTS);
-	dispose_array(&REACHABLE_OBJECTS);
+	type_t type = type_of(expr);
+	if (type->eval)
+		return type->eval(scope, expr);
+	return NULL;
 }
 
-object_t pop_from_list_or_die(object_t* ptr)
-{
-	object_t result = pop_from_list(ptr);
-	if (! result)
-		DIE("Premature end of list");
-	return result;
-}
+struct local {
+	struct object self;
+	symbol_t name;
+	int depth;
+	int slot;
+};
 
-// CUTOFF
+typedef struct local* local_t;
 
-bool unbox_int(int*, object_t);
+object_t eval_local(scope_t scope, object_t obj)
+{
+	local_t local = (local_t)obj;
+	for (int i = local->depth; i > 0; i--)
+		scope = scope->parent;
 
-bool eq(struct object* x, struct object* y);
+	object_t value = scope->slots[local->slot];
+	if (! value)
+		DIE("Undefined variable %s", unwrap_symbol(local->name));
+	return hold(value);
+}
 
-object_t native_cons(int argct, object_t* args) // cons
+void reach_local(object_t obj)
 {
-	assert_arg_count("cons", argct, 2);
-	return wrap_pair(args[0], args[1]);
+	local_t local = (local_t)obj;
+	mark_reachable((object_t)local->name);
 }
 
-object_t native_eqp(int argct, object_t* args) // eq?
+void write_local(FILE* out, object_t obj)
 {
-	assert_arg_count("eq?", argct, 2);
-	return wrap_bool(eq(args[0], args[1]));
+	local_t local = (local_t)obj;
+	write_object(out, (object_t)local->name);
 }
 
-object_t native_list(int argct, object_t* args) // list
+struct type TYPE_LOCAL = {
+	.name = "local",
+	.eval = eval_local,
+	.reach = reach_local,
+	.write = write_local,
+};
+
+object_t wrap_local(symbol_t name, int depth, int slot)
 {
-	object_t result = wrap_nil();
+	local_t local = alloc_object(&TYPE_LOCAL, sizeof(*local));
+	local->name = name;
+	local->depth = depth;
+	local->slot = slot;
+	return (object_t)local;
+}
 
-	for (int i = argct - 1; i >= 0; i--)
-		push_to_list(&result, args[i]);
+enum arith {
+	ARITH_PLUS,
+	ARITH_MINUS,
+	ARITH_MULT,
+	ARITH_LESS,
+	ARITH_EQUALS,
+	ARITH_MODULO,
+	ARITH_COUNT,
+};
 
-	return result;
-}
+object_t native_modulo(int, object_t*);
+object_t native_num_equals(int, object_t*);
+object_t native_num_less(int, object_t*);
+object_t native_num_minus(int, object_t*);
+object_t native_num_mult(int, object_t*);
+object_t native_num_plus(int, object_t*);
+
+object_t (*ARITH_NATIVES[ARITH_COUNT])(int, object_t*) = {
+	[ARITH_PLUS] = native_num_plus,
+	[ARITH_MINUS] = native_num_minus,
+	[ARITH_MULT] = native_num_mult,
+	[ARITH_LESS] = native_num_less,
+	[ARITH_EQUALS] = native_num_equals,
+	[ARITH_MODULO] = native_modulo,
+};
 
-object_t native_fold(int argct, object_t* args) // fold
+native_t to_native(object_t);
+
+int arith_kind(object_t value)
+{
+	native_t native = value ? to_native(value) : NULL;
+	if (! native)
+		return -1;
+
+	for (int i = 0; i < ARITH_COUNT; i++)
+		if (native->invoke == ARITH_NATIVES[i])
+			return i;
+	return -1;
+}
+
+object_t arith_ints(int op, int x, int y)
+{
+	int result;
+
+	switch (op) {
+	case ARITH_PLUS:
+		if (__builtin_add_overflow(x, y, &result))
+			DIE("Integer overflow in +");
+		return wrap_int(result);
+	case ARITH_MINUS:
+		if (__builtin_sub_overflow(x, y, &result))
+			DIE("Integer overflow in -");
+		return wrap_int(result);
+	case ARITH_MULT:
+		if (__builtin_mul_overflow(x, y, &result))
+			DIE("Integer overflow in *");
+		return wrap_int(result);
+	case ARITH_LESS:
+		return wrap_bool(x < y);
+	case ARITH_EQUALS:
+		return wrap_bool(x == y);
+	case ARITH_MODULO:
+		if (y == 0)
+			DIE("Division by zero in modulo");
+		return wrap_int((y == -1) ? 0 : x % y);
+	}
+	DIE("Unknown arithmetic operation %d", op);
+}
+
+struct global {
+	struct object self;
+	symbol_t name;
+	object_t* slot;
+	object_t value;
+	syntax_t syntax;
+	int arith;
+	unsigned int version;
+};
+
+typedef struct global* global_t;
+
+// The slot stays put until a binding is added, which bumps the version;
+// a `set!` only changes what's in it, so the rest is only worked out again
+// once the value is seen to be a different one
+object_t resolve_global(global_t global)
+{
+	if (global->version != BINDINGS_VERSION) {
+		dict_t binds = &get_repl_scope()->binds;
+		dict_entry_t entry = find_in_dict(binds, global->name);
+		global->slot = entry ? &entry->value : NULL;
+		global->value = NULL;
+		global->syntax = NULL;
+		global->arith = -1;
+		global->version = BINDINGS_VERSION;
+	}
+
+	object_t value = global->slot ? *global->slot : NULL;
+	if (value && (value != global->value)) {
+		global->value = value;
+		global->syntax = to_syntax(value);
+		global->arith = arith_kind(value);
+	}
+	return value;
+}
+
+object_t eval_global(scope_t scope, object_t obj)
+{
+	global_t global = (global_t)obj;
+	object_t value = resolve_global(global);
+	if (! value)
+		DIE("Undefined variable %s", unwrap_symbol(global->name));
+	return hold(value);
+}
+
+void reach_global(object_t obj)
+{
+	global_t global = (global_t)obj;
+	mark_reachable((object_t)global->name);
+}
+
+void write_global(FILE* out, object_t obj)
+{
+	global_t global = (global_t)obj;
+	write_object(out, (object_t)global->name);
+}
+
+struct type TYPE_GLOBAL = {
+	.name = "global",
+	.eval = eval_global,
+	.reach = reach_global,
+	.write = write_global,
+};
+
+bool unbox_int(int*, object_t);
+
+object_t arith(global_t global, int op, object_t a, object_t b)
+{
+	int x, y;
+	object_t func = resolve_global(global);
+
+	if (global->arith == op && unbox_int(&x, a) && unbox_int(&y, b))
+		return arith_ints(op, x, y);
+
+	if (! func)
+		DIE("Undefined variable %s", unwrap_symbol(global->name));
+	object_t args[] = {a, b};
+	return invoke(func, 2, args);
+}
+
+object_t eval_arith(scope_t scope, global_t global, object_t body)
+{
+	pair_t first = to_pair(body);
+	pair_t second = first ? to_pair(cdr(first)) : NULL;
+	if (! second || ! is_nil(cdr(second)))
+		return NULL;
+
+	object_t a = eval_eager(scope, car(first));
+	object_t b = eval_eager(scope, car(second));
+	return arith(global, global->arith, a, b);
+}
+
+object_t eval_cached(scope_t scope, object_t head, object_t body)
+{
+	syntax_t syntax = to_syntax(head);
+	if (syntax)
+		return syntax->eval(scope, body);
+	if (type_of(head) != &TYPE_GLOBAL)
+		return NULL;
+
+	global_t global = (global_t)head;
+	object_t value = resolve_global(global);
+	if (! value)
+		return NULL;
+	if (global->syntax)
+		return global->syntax->eval(scope, body);
+	if (global->arith >= 0) {
+		object_t result = eval_arith(scope, global, body);
+		if (result)
+			return result;
+	}
+
+	return eval_funcall(scope, hold(value), body);
+}
+
+object_t wrap_global(symbol_t name)
+{
+	global_t global = alloc_object(&TYPE_GLOBAL, sizeof(*global));
+	global->name = name;
+	global->slot = NULL;
+	global->value = NULL;
+	global->syntax = NULL;
+	global->arith = -1;
+	global->version = BINDINGS_VERSION - 1;
+	return (object_t)global;
+}
+
+object_t eval_template(scope_t scope, object_t obj)
+{
+	return instantiate(scope, (template_t)obj);
+}
+
+void reach_template(object_t obj)
+{
+	template_t template = (template_t)obj;
+	reach_field(&template->params);
+	reach_field(&template->body);
+	reach_field(&template->code);
+	for (int i = template->names.size - 1; i >= 0; i--)
+		mark_reachable(template->names.data[i]);
+	for (int i = template->constants.size - 1; i >= 0; i--)
+		reach_field(&template->constants.data[i]);
+}
+
+void dispose_template(object_t obj)
+{
+	template_t template = (template_t)obj;
+	dispose_array(&template->args);
+	dispose_array(&template->names);
+	dispose_array(&template->constants);
+	free(template->ops);
+}
+
+void write_template(FILE* out, object_t obj)
+{
+	template_t template = (template_t)obj;
+	object_t body = template->body, expr;
+
+	fputs("(lambda ", out);
+	write_object(out, template->params);
+	while ((expr = pop_from_list(&body))) {
+		fputc(' ', out);
+		write_object(out, expr);
+	}
+	fputc(')', out);
+}
+
+struct type TYPE_TEMPLATE = {
+	.name = "template",
+	.dispose = dispose_template,
+	.eval = eval_template,
+	.reach = reach_template,
+	.write = write_template,
+};
+
+object_t instantiate(scope_t scope, template_t template)
+{
+	assert_on_heap(scope);
+	lambda_t lambda = alloc_object(&TYPE_LAMBDA, sizeof(*lambda));
+	lambda->body = template->body;
+	lambda->scope = scope;
+	lambda->template = template;
+	return (object_t)lambda;
+}
+
+scope_t bind_frame(lambda_t lambda, int argct, object_t* args)
+{
+	template_t template = lambda->template;
+	const char* name = lambda->label ? unwrap_symbol(lambda->label) : NULL;
+
+	int fixed = template->args.size;
+	assert_arity(name, argct, fixed, template->rest);
+
+	scope_t scope = derive_frame(lambda->scope, template);
+	for (int i = 0; i < fixed; i++) {
+		scope->slots[i] = args[i];
+		set_label(args[i], (symbol_t)template->args.data[i]);
+	}
+	if (template->rest) {
+		object_t rest = rest_list(argct - fixed, &args[fixed]);
+		write_barrier((object_t)scope, NULL, rest);
+		scope->slots[fixed] = rest;
+	}
+	return scope;
+}
+
+bool USE_VM = false;
+
+bool compile_template(template_t);
+object_t run_vm(lambda_t lambda, int argct, object_t* args);
+
+object_t invoke_template(lambda_t lambda, int argct, object_t* args)
+{
+	if (USE_VM && compile_template(lambda->template))
+		return run_vm(lambda, argct, args);
+
+	scope_t scope = bind_frame(lambda, argct, args);
+	return eval_block(scope, lambda->template->code);
+}
+
+//
+
+struct layout {
+	struct layout* parent;
+	array_t names;
+	bool slots;
+};
+
+int find_name(array_t names, symbol_t name)
+{
+	for (int i = 0; i < names->size; i++)
+		if (names->data[i] == (object_t)name)
+			return i;
+	return -1;
+}
+
+struct layout* find_layout(struct layout* layout, symbol_t name, int* depth)
+{
+	for (*depth = 0; layout; layout = layout->parent, (*depth)++)
+		if (find_name(layout->names, name) >= 0)
+			return layout;
+	return NULL;
+}
+
+object_t resolve_var(struct layout* layout, symbol_t name)
+{
+	int depth;
+	struct layout* found = find_layout(layout, name, &depth);
+
+	if (! found)
+		return wrap_global(name);
+
+	if (! found->slots)
+		return (object_t)name;
+
+	return wrap_local(name, depth, find_name(found->names, name));
+}
+
+syntax_t static_syntax(struct layout* layout, object_t head)
+{
+	int depth;
+	symbol_t name = to_symbol(head);
+	if (! name || find_layout(layout, name, &depth))
+		return NULL;
+
+	object_t value = lookup_in_scope(get_repl_scope(), name);
+	return value ? to_syntax(value) : NULL;
+}
+
+void collect_defines(struct layout* layout, object_t body)
+{
+	pair_t cell;
+
+	for (; (cell = to_pair(body)); body = cdr(cell)) {
+		pair_t form = to_pair(car(cell));
+		if (! form)
+			continue;
+
+		syntax_t syntax = static_syntax(layout, car(form));
+		if (! syntax || syntax->eval != syntax_define)
+			continue;
+
+		pair_t rest = to_pair(cdr(form));
+		if (! rest)
+			continue;
+
+		object_t head = car(rest);
+		pair_t head_params = to_pair(head);
+		symbol_t name =
+			to_symbol(head_params ? car(head_params) : head);
+
+		if (name && find_name(layout->names, name) < 0)
+			push_to_array(layout->names, (object_t)name);
+	}
+}
+
+object_t analyze(struct layout*, object_t expr);
+object_t reverse(object_t list);
+
+object_t analyze_list(struct layout* layout, object_t list)
+{
+	object_t acc = wrap_nil();
+	pair_t cell;
+
+	for (; (cell = to_pair(list)); list = cdr(cell)) {
+		object_t item = analyze(layout, car(cell));
+		if (! item)
+			break;
+		push_to_list(&acc, item);
+	}
+
+	return is_nil(list) ? reverse(acc) : NULL;
+}
+
+object_t analyze_define(struct layout* layout, object_t code)
+{
+	pair_t cell = to_pair(code);
+	if (! cell)
+		return NULL;
+
+	object_t head = car(cell), value;
+	pair_t head_params = to_pair(head);
+	symbol_t name = to_symbol(head_params ? car(head_params) : head);
+
+	if (! name || find_name(layout->names, name) < 0)
+		return NULL;
+
+	if (head_params) {
+		template_t template =
+			analyze_lambda(layout, cdr(head_params), cdr(cell));
+		value = template ? wrap_pair((object_t)template, wrap_nil())
+				 : NULL;
+	} else {
+		value = analyze_list(layout, cdr(cell));
+	}
+
+	if (! value)
+		return NULL;
+
+	return wrap_pair((object_t)name, value);
+}
+
+object_t analyze_set(struct layout* layout, object_t code)
+{
+	pair_t cell = to_pair(code);
+	if (! cell || ! to_symbol(car(cell)))
+		return NULL;
+
+	object_t value = analyze_list(layout, cdr(cell));
+	if (! value)
+		return NULL;
+
+	return wrap_pair(car(cell), value);
+}
+
+object_t analyze_clause(struct layout* layout, object_t clause)
+{
+	pair_t cell = to_pair(clause);
+	if (! cell || ! is_symbol("else", car(cell)))
+		return analyze_list(layout, clause);
+
+	object_t body = analyze_list(layout, cdr(cell));
+	if (! body)
+		return NULL;
+
+	return wrap_pair(car(cell), body);
+}
+
+object_t analyze_cond(struct layout* layout, object_t code)
+{
+	object_t acc = wrap_nil();
+	pair_t cell;
+
+	for (; (cell = to_pair(code)); code = cdr(cell)) {
+		object_t clause = analyze_clause(layout, car(cell));
+		if (! clause)
+			break;
+		push_to_list(&acc, clause);
+	}
+
+	return is_nil(code) ? reverse(acc) : NULL;
+}
+
+symbol_t binding_name(object_t binding)
+{
+	pair_t cell = to_pair(binding);
+	if (! cell)
+		return NULL;
+
+	pair_t rest = to_pair(cdr(cell));
+	if (! rest || ! is_nil(cdr(rest)))
+		return NULL;
+
+	return to_symbol(car(cell));
+}
+
+object_t analyze_binding(struct layout* layout, object_t binding)
+{
+	pair_t cell = (pair_t)binding;
+	object_t value = analyze_list(layout, cdr(cell));
+	if (! value)
+		return NULL;
+
+	return wrap_pair(car(cell), value);
+}
+
+object_t analyze_let(struct layout* outer, object_t code, bool recursive)
+{
+	pair_t cell = to_pair(code);
+	if (! cell)
+		return NULL;
+
+	struct array names;
+	init_array(&names);
+	struct layout inner = {outer, &names, false};
+
+	object_t bindings = car(cell), binding;
+	pair_t item;
+
+	for (; (item = to_pair(bindings)); bindings = cdr(item)) {
+		symbol_t name = binding_name(car(item));
+		if (! name)
+			break;
+		push_to_array(&names, (object_t)name);
+	}
+
+	object_t result = NULL, acc = wrap_nil();
+	if (! is_nil(bindings))
+		goto out;
+
+	collect_defines(&inner, cdr(cell));
+
+	for (bindings = car(cell); (item = to_pair(bindings));
+	     bindings = cdr(item)) {
+		binding =
+			analyze_binding(recursive ? &inner : outer, car(item));
+		if (! binding)
+			goto out;
+		push_to_list(&acc, binding);
+	}
+
+	object_t body = analyze_list(&inner, cdr(cell));
+	if (body)
+		result = wrap_pair(reverse(acc), body);
+
+out:
+	dispose_array(&names);
+	return result;
+}
+
+object_t analyze_letseq(struct layout* outer, object_t code)
+{
+	pair_t cell = to_pair(code);
+	if (! cell)
+		return NULL;
+
+	int count = 0;
+	object_t bindings = car(cell);
+	pair_t item;
+
+	for (; (item = to_pair(bindings)); bindings = cdr(item), count++)
+		if (! binding_name(car(item)))
+			return NULL;
+	if (! is_nil(bindings))
+		return NULL;
+
+	struct layout* layouts = calloc(count + 1, sizeof(struct layout));
+	struct array* names = calloc(count + 1, sizeof(struct array));
+	struct layout* layout = outer;
+	object_t result = NULL, acc = wrap_nil(), binding;
+	int i = 0;
+
+	for (bindings = car(cell); (item = to_pair(bindings));
+	     bindings = cdr(item), i++) {
+		binding = analyze_binding(layout, car(item));
+		if (! binding)
+			goto out;
+		push_to_list(&acc, binding);
+
+		init_array(&names[i]);
+		push_to_array(&names[i], (object_t)binding_name(car(item)));
+		layouts[i] = (struct layout){layout, &names[i], false};
+		layout = &layouts[i];
+	}
+
+	if (count > 0)
+		collect_defines(layout, cdr(cell));
+
+	object_t body = analyze_list(layout, cdr(cell));
+	if (body)
+		result = wrap_pair(reverse(acc), body);
+
+out:
+	while (i-- > 0)
+		dispose_array(&names[i]);
+	free(layouts);
+	free(names);
+	return result;
+}
+
+object_t syntax_and(scope_t, object_t);
+object_t syntax_cond(scope_t, object_t);
+object_t syntax_lambda(scope_t, object_t);
+object_t syntax_let(scope_t, object_t);
+object_t syntax_letrec(scope_t, object_t);
+object_t syntax_letseq(scope_t, object_t);
+object_t syntax_or(scope_t, object_t);
+object_t syntax_set(scope_t, object_t);
+object_t syntax_identity(scope_t, object_t);
+object_t syntax_stack_let(scope_t, object_t);
+object_t syntax_stack_letrec(scope_t, object_t);
+
+//
+// Most `let` scopes only live as long as their body runs, and die right
+// after. Only a lambda can keep one around for longer, by closing over it
+// (a `define` of `(name args...)` makes one too). So if there's no lambda
+// anywhere inside, the scope can just as well be a local variable of the
+// C function evaluating the form, with no allocation and nothing for the
+// collector to clean up after.
+//
+// `may_capture()` looks for such lambdas. It only knows syntax by its
+// global name, just the way the rest of the analysis does, and anything it
+// can't be sure about counts as a capture.
+//
+
+bool may_capture(struct layout* layout, object_t expr)
+{
+	pair_t form = to_pair(expr);
+	if (! form)
+		return false;
+
+	syntax_t syntax = static_syntax(layout, car(form));
+	object_t (*eval)(scope_t, object_t) = syntax ? syntax->eval : NULL;
+	if (eval == syntax_quote)
+		return false;
+	if (eval == syntax_lambda)
+		return true;
+	if (eval == syntax_define) {
+		pair_t cell = to_pair(cdr(form));
+		if (! cell || to_pair(car(cell)))
+			return true;
+	}
+
+	for (; form; form = to_pair(cdr(form)))
+		if (may_capture(layout, car(form)))
+			return true;
+	return false;
+}
+
+//
+// `let` evaluates its bindings outside of the new scope, so only its body
+// matters, whereas `letrec` and `let*` evaluate them inside. A `let*` also
+// gets a single scope instead of one per binding, which is the same thing
+// as `letrec` as long as no name is bound twice.
+//
+
+_Thread_local struct stack_syntax {
+	syntax_t let;
+	syntax_t letrec;
+} STACK_SYNTAX;
+
+syntax_t stack_syntax(struct layout* layout, syntax_t syntax, object_t code)
+{
+	pair_t cell = to_pair(code);
+	if (! cell || may_capture(layout, cdr(cell)))
+		return NULL;
+	if (syntax->eval == syntax_let)
+		return STACK_SYNTAX.let;
+
+	struct array names;
+	init_array(&names);
+	object_t bindings = car(cell);
+	syntax_t result = STACK_SYNTAX.letrec;
+
+	for (; (cell = to_pair(bindings)); bindings = cdr(cell)) {
+		symbol_t name = binding_name(car(cell));
+		if (! name || find_name(&names, name) >= 0 ||
+		    may_capture(layout, car(cell))) {
+			result = NULL;
+			break;
+		}
+		push_to_array(&names, (object_t)name);
+	}
+
+	dispose_array(&names);
+	return result;
+}
+
+object_t analyze_form(struct layout* layout, syntax_t syntax, pair_t form)
+{
+	object_t (*eval)(scope_t, object_t) = syntax->eval;
+	object_t code = cdr(form), rest;
+	syntax_t stacked = NULL;
+
+	if (eval == syntax_lambda) {
+		pair_t cell = to_pair(code);
+		if (! cell)
+			return NULL;
+		return (object_t)analyze_lambda(layout, car(cell), cdr(cell));
+	}
+
+	if (eval == syntax_quote) {
+		rest = code;
+	} else if (eval == syntax_define) {
+		rest = analyze_define(layout, code);
+	} else if (eval == syntax_set) {
+		rest = analyze_set(layout, code);
+	} else if (eval == syntax_cond) {
+		rest = analyze_cond(layout, code);
+	} else if (eval == syntax_let) {
+		rest = analyze_let(layout, code, false);
+		stacked = stack_syntax(layout, syntax, code);
+	} else if (eval == syntax_letrec) {
+		rest = analyze_let(layout, code, true);
+		stacked = stack_syntax(layout, syntax, code);
+	} else if (eval == syntax_letseq) {
+		stacked = stack_syntax(layout, syntax, code);
+		rest = stacked ? analyze_let(layout, code, true)
+			       : analyze_letseq(layout, code);
+	} else if (eval == syntax_identity) {
+		rest = analyze(layout, code);
+	} else if (eval == syntax_if || eval == syntax_and ||
+		   eval == syntax_or) {
+		rest = analyze_list(layout, code);
+	} else {
+		return NULL;
+	}
+
+	if (! rest)
+		return NULL;
+
+	object_t head = stacked ? (object_t)stacked
+				: resolve_var(layout, (symbol_t)car(form));
+	return wrap_pair(head, rest);
+}
+
+object_t analyze(struct layout* layout, object_t expr)
+{
+	symbol_t name = to_symbol(expr);
+	if (name)
+		return resolve_var(layout, name);
+
+	pair_t form = to_pair(expr);
+	if (! form)
+		return expr;
+
+	syntax_t syntax = static_syntax(layout, car(form));
+	if (syntax)
+		return analyze_form(layout, syntax, form);
+
+	return analyze_list(layout, expr);
+}
+
+template_t analyze_lambda(struct layout* parent, object_t params, object_t body)
+{
+	template_t template = alloc_object(&TYPE_TEMPLATE, sizeof(*template));
+	template->params = params;
+	template->body = body;
+	init_array(&template->args);
+	init_array(&template->names);
+
+	pair_t cell;
+	for (; (cell = to_pair(params)); params = cdr(cell)) {
+		symbol_t name = to_symbol(car(cell));
+		if (! name)
+			break;
+		push_to_array(&template->args, (object_t)name);
+		push_to_array(&template->names, (object_t)name);
+	}
+	if ((template->rest = to_symbol(params))) {
+		push_to_array(&template->names, params);
+		params = wrap_nil();
+	}
+
+	if (is_nil(params)) {
+		struct layout layout = {parent, &template->names, true};
+		collect_defines(&layout, body);
+		object_t code = analyze_list(&layout, body);
+		write_barrier((object_t)template, NULL, code);
+		template->code = code;
+	}
+
+	if (! template->code)
+		return NULL;
+
+	return template;
+}
+
+//
+
+enum opcode {
+	OP_CONST,
+	OP_LOCAL,
+	OP_GLOBAL,
+	OP_LOOKUP,
+	OP_CLOSURE,
+	OP_DEFINE,
+	OP_SET,
+	OP_POP,
+	OP_JUMP,
+	OP_JUMP_UNLESS,
+	OP_AND,
+	OP_OR,
+	OP_LET,
+	OP_ENTER,
+	OP_BIND,
+	OP_LEAVE,
+	OP_ARITH,
+	OP_CALL,
+	OP_TAIL_CALL,
+	OP_RETURN,
+};
+
+enum let_kind {
+	LET_PARALLEL,
+	LET_RECURSIVE,
+	LET_SEQUENTIAL,
+};
+
+void set_in_scope(scope_t, symbol_t, object_t);
+
+int emit(template_t template, int op)
+{
+	if (template->opct == template->opcap) {
+		template->opcap = template->opcap ? template->opcap * 2 : 32;
+		template->ops =
+			realloc(template->ops, template->opcap * sizeof(int));
+	}
+	template->ops[template->opct] = op;
+	return template->opct++;
+}
+
+int add_constant(template_t template, object_t obj)
+{
+	push_to_array(&template->constants, obj);
+	return template->constants.size - 1;
+}
+
+void emit_with(template_t template, int op, object_t obj)
+{
+	emit(template, op);
+	emit(template, add_constant(template, obj));
+}
+
+void patch_jump(template_t template, int at)
+{
+	template->ops[at] = template->opct;
+}
+
+object_t global_value(global_t global)
+{
+	return eval_global(NULL, (object_t)global);
+}
+
+syntax_t global_syntax(object_t head)
+{
+	if (type_of(head) != &TYPE_GLOBAL)
+		return NULL;
+
+	resolve_global((global_t)head);
+	return ((global_t)head)->syntax;
+}
+
+int arith_of(object_t head)
+{
+	if (type_of(head) != &TYPE_GLOBAL)
+		return -1;
+
+	resolve_global((global_t)head);
+	return ((global_t)head)->arith;
+}
+
+int list_length(object_t list)
+{
+	int count = 0;
+	pair_t cell;
+	for (; (cell = to_pair(list)); list = cdr(cell))
+		count++;
+	return is_nil(list) ? count : -1;
+}
+
+bool compile_expr(template_t, object_t expr, bool tail);
+
+bool compile_value(template_t template, object_t value, bool tail)
+{
+	emit_with(template, OP_CONST, value);
+	if (tail)
+		emit(template, OP_RETURN);
+	return true;
+}
+
+bool compile_block(template_t template, object_t body, bool tail)
+{
+	object_t expr;
+
+	if (is_nil(body))
+		return compile_value(template, wrap_nil(), tail);
+
+	while ((expr = pop_from_list(&body))) {
+		bool last = is_nil(body);
+		if (! compile_expr(template, expr, tail && last))
+			return false;
+		if (! last)
+			emit(template, OP_POP);
+	}
+	return true;
+}
+
+bool compile_if(template_t template, object_t code, bool tail)
+{
+	int count = list_length(code);
+	if (count != 2 && count != 3)
+		return false;
+
+	object_t test = pop_from_list(&code);
+	object_t consequent = pop_from_list(&code);
+	object_t alternate = pop_from_list(&code);
+
+	if (! compile_expr(template, test, false))
+		return false;
+	emit(template, OP_JUMP_UNLESS);
+	int otherwise = emit(template, 0);
+
+	if (! compile_expr(template, consequent, tail))
+		return false;
+	int done = -1;
+	if (! tail) {
+		emit(template, OP_JUMP);
+		done = emit(template, 0);
+	}
+
+	patch_jump(template, otherwise);
+	if (alternate) {
+		if (! compile_expr(template, alternate, tail))
+			return false;
+	} else {
+		compile_value(template, wrap_nil(), tail);
+	}
+
+	if (done >= 0)
+		patch_jump(template, done);
+	return true;
+}
+
+bool compile_cond(template_t template, object_t code, bool tail)
+{
+	struct array exits;
+	init_array(&exits);
+	object_t clause;
+	bool ok = true, closed = false;
+
+	while (ok && (clause = pop_from_list(&code))) {
+		pair_t cell = to_pair(clause);
+		if (! cell) {
+			ok = false;
+			break;
+		}
+
+		if (is_symbol("else", car(cell))) {
+			ok = compile_block(template, cdr(cell), tail);
+			closed = true;
+			break;
+		}
+
+		ok = compile_expr(template, car(cell), false);
+		emit(template, OP_JUMP_UNLESS);
+		int next = emit(template, 0);
+		ok = ok && compile_block(template, cdr(cell), tail);
+		if (! tail) {
+			emit(template, OP_JUMP);
+			int at = emit(template, 0);
+			push_to_array(&exits, (object_t)(intptr_t)at);
+		}
+		patch_jump(template, next);
+	}
+
+	if (ok && ! closed)
+		ok = compile_value(template, wrap_nil(), tail);
+
+	for (int i = 0; i < exits.size; i++)
+		patch_jump(template, (intptr_t)exits.data[i]);
+	dispose_array(&exits);
+	return ok;
+}
+
+bool compile_logic(template_t template, object_t code, bool tail, int op)
+{
+	if (is_nil(code))
+		return compile_value(template, wrap_bool(op == OP_AND), tail);
+
+	struct array exits;
+	init_array(&exits);
+	object_t expr;
+	bool ok = true;
+
+	while (ok && (expr = pop_from_list(&code))) {
+		if (is_nil(code)) {
+			ok = compile_expr(template, expr, tail);
+			break;
+		}
+		ok = compile_expr(template, expr, false);
+		emit(template, op);
+		push_to_array(&exits, (object_t)(intptr_t)emit(template, 0));
+	}
+
+	for (int i = 0; i < exits.size; i++)
+		patch_jump(template, (intptr_t)exits.data[i]);
+	if (tail && exits.size > 0)
+		emit(template, OP_RETURN);
+	dispose_array(&exits);
+	return ok;
+}
+
+bool compile_named(template_t template, int op, object_t code, bool tail)
+{
+	if (list_length(code) != 2 || ! to_symbol(car((pair_t)code)))
+		return false;
+
+	pair_t cell = (pair_t)code;
+	object_t expr = car((pair_t)cdr(cell));
+	if (! compile_expr(template, expr, false))
+		return false;
+
+	emit_with(template, op, car(cell));
+	if (tail)
+		emit(template, OP_RETURN);
+	return true;
+}
+
+bool compile_let(template_t template,
+		 object_t code,
+		 bool tail,
+		 enum let_kind kind)
+{
+	pair_t cell = to_pair(code);
+	if (! cell || list_length(car(cell)) < 0)
+		return false;
+
+	object_t bindings = car(cell), binding;
+	int count = list_length(bindings), scopes = 0;
+
+	if (kind == LET_RECURSIVE) {
+		emit(template, OP_ENTER);
+		scopes = 1;
+	}
+
+	while ((binding = pop_from_list(&bindings))) {
+		pair_t item = (pair_t)binding;
+		if (! compile_expr(template, car((pair_t)cdr(item)), false))
+			return false;
+
+		if (kind == LET_PARALLEL)
+			continue;
+		if (kind == LET_RECURSIVE) {
+			emit_with(template, OP_BIND, car(item));
+			continue;
+		}
+
+		emit(template, OP_LET);
+		emit(template, 1);
+		emit(template, add_constant(template, car(item)));
+		scopes++;
+	}
+
+	if (kind == LET_PARALLEL) {
+		emit(template, OP_LET);
+		emit(template, count);
+		bindings = car(cell);
+		while ((binding = pop_from_list(&bindings))) {
+			object_t name = car((pair_t)binding);
+			emit(template, add_constant(template, name));
+		}
+		scopes = 1;
+	}
+
+	if (! compile_block(template, cdr(cell), tail))
+		return false;
+
+	if (! tail)
+		while (scopes-- > 0)
+			emit(template, OP_LEAVE);
+	return true;
+}
+
+bool compile_call(template_t template, pair_t form, bool tail)
+{
+	object_t head = car(form), args = cdr(form), arg;
+	int argct = list_length(args);
+	int arith = arith_of(head);
+
+	if (arith >= 0 && argct == 2) {
+		while ((arg = pop_from_list(&args)))
+			if (! compile_expr(template, arg, false))
+				return false;
+		emit(template, OP_ARITH);
+		emit(template, arith);
+		emit(template, add_constant(template, head));
+		if (tail)
+			emit(template, OP_RETURN);
+		return true;
+	}
+
+	if (! compile_expr(template, head, false))
+		return false;
+	while ((arg = pop_from_list(&args)))
+		if (! compile_expr(template, arg, false))
+			return false;
+
+	emit(template, tail ? OP_TAIL_CALL : OP_CALL);
+	emit(template, argct);
+	return true;
+}
+
+bool compile_form(template_t template, pair_t form, bool tail)
+{
+	syntax_t syntax = to_syntax(car(form));
+	if (! syntax)
+		syntax = global_syntax(car(form));
+	if (! syntax)
+		return compile_call(template, form, tail);
+
+	object_t (*eval)(scope_t, object_t) = syntax->eval;
+	object_t code = cdr(form);
+
+	if (eval == syntax_quote) {
+		pair_t cell = to_pair(code);
+		return cell && compile_value(template, car(cell), tail);
+	}
+	if (eval == syntax_if)
+		return compile_if(template, code, tail);
+	if (eval == syntax_cond)
+		return compile_cond(template, code, tail);
+	if (eval == syntax_and)
+		return compile_logic(template, code, tail, OP_AND);
+	if (eval == syntax_or)
+		return compile_logic(template, code, tail, OP_OR);
+	if (eval == syntax_define)
+		return compile_named(template, OP_DEFINE, code, tail);
+	if (eval == syntax_set)
+		return compile_named(template, OP_SET, code, tail);
+	if (eval == syntax_let || eval == syntax_stack_let)
+		return compile_let(template, code, tail, LET_PARALLEL);
+	if (eval == syntax_letrec || eval == syntax_stack_letrec)
+		return compile_let(template, code, tail, LET_RECURSIVE);
+	if (eval == syntax_letseq)
+		return compile_let(template, code, tail, LET_SEQUENTIAL);
+	if (eval == syntax_identity)
+		return compile_expr(template, code, tail);
+	return false;
+}
+
+bool compile_expr(template_t template, object_t expr, bool tail)
+{
+	pair_t form = to_pair(expr);
+	if (form)
+		return compile_form(template, form, tail);
+
+	type_t type = type_of(expr);
+	if (type == &TYPE_LOCAL) {
+		local_t local = (local_t)expr;
+		emit(template, OP_LOCAL);
+		emit(template, local->depth);
+		emit(template, local->slot);
+	} else if (type == &TYPE_GLOBAL) {
+		emit_with(template, OP_GLOBAL, expr);
+	} else if (to_symbol(expr)) {
+		emit_with(template, OP_LOOKUP, expr);
+	} else if (type == &TYPE_TEMPLATE) {
+		emit_with(template, OP_CLOSURE, expr);
+	} else {
+		emit_with(template, OP_CONST, expr);
+	}
+
+	if (tail)
+		emit(template, OP_RETURN);
+	return true;
+}
+
+bool compile_template(template_t template)
+{
+	if (template->compiled)
+		return template->ops != NULL;
+
+	template->compiled = true;
+	init_array(&template->constants);
+	if (compile_block(template, template->code, true))
+		return true;
+
+	free(template->ops);
+	template->ops = NULL;
+	return false;
+}
+
+//
+
+struct vm_frame {
+	template_t template;
+	int pc;
+	scope_t scope;
+};
+
+_Thread_local struct vm {
+	struct vm_frame* frames;
+	int depth;
+	int avail;
+	struct array stack;
+} VM;
+
+void push_frame(template_t template, scope_t scope)
+{
+	if (VM.depth == VM.avail) {
+		VM.avail = VM.avail ? VM.avail * 2 : 64;
+		VM.frames = realloc(VM.frames, VM.avail * sizeof(*VM.frames));
+	}
+	VM.frames[VM.depth++] = (struct vm_frame){template, 0, scope};
+}
+
+// The value stack and the frames are roots, and a frame's innermost scope
+// leads to all the rest
+void visit_vm(void (*visit)(object_t))
+{
+	for (int i = 0; i < VM.stack.size; i++)
+		visit(VM.stack.data[i]);
+	for (int i = 0; i < VM.depth; i++) {
+		visit((object_t)VM.frames[i].scope);
+		visit((object_t)VM.frames[i].template);
+	}
+}
+
+object_t* stack_top(int count)
+{
+	return &VM.stack.data[VM.stack.size - count];
+}
+
+void drop_values(int count)
+{
+	VM.stack.size -= count;
+}
+
+lambda_t compiled_lambda(object_t func)
+{
+	lambda_t lambda = to_lambda(func);
+	if (lambda && lambda->template && compile_template(lambda->template))
+		return lambda;
+	return NULL;
+}
+
+object_t call_foreign(object_t func, int argct, bool tail_thunk)
+{
+	object_t* args = reserve_args(argct);
+	memcpy(args, stack_top(argct), argct * sizeof(object_t));
+	VM.stack.size -= argct;
+
+	object_t result;
+	lambda_t lambda = to_lambda(func);
+	if (tail_thunk && lambda)
+		result = wrap_thunk(lambda, argct, args);
+	else if (tail_thunk)
+		result = invoke_lazily(func, argct, args);
+	else
+		result = invoke(func, argct, args);
+
+	release_args(argct);
+	VM.stack.size--;
+	return result;
+}
+
+object_t run_vm(lambda_t lambda, int argct, object_t* args)
+{
+	int entry = VM.depth, mark = open_frame();
+	push_frame(lambda->template, bind_frame(lambda, argct, args));
+
+	while (true) {
+		// Whatever an instruction keeps is on the stack or in a frame
+		close_frame(mark);
+		struct vm_frame* frame = &VM.frames[VM.depth - 1];
+		template_t template = frame->template;
+		int* ops = template->ops;
+		object_t* constants = template->constants.data;
+		object_t value, func;
+		lambda_t callee;
+		scope_t scope;
+		int count, at;
+		int op = ops[frame->pc++];
+
+		switch (op) {
+		case OP_CONST:
+			value = constants[ops[frame->pc++]];
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_LOCAL:
+			scope = frame->scope;
+			for (count = ops[frame->pc++]; count > 0; count--)
+				scope = scope->parent;
+			value = scope->slots[ops[frame->pc++]];
+			if (! value) {
+				array_t names = &scope->template->names;
+				object_t name = names->data[ops[frame->pc - 1]];
+				DIE("Undefined variable %s",
+				    unwrap_symbol((symbol_t)name));
+			}
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_GLOBAL:
+			value = constants[ops[frame->pc++]];
+			push_to_array(&VM.stack, eval_global(NULL, value));
+			break;
+
+		case OP_LOOKUP:
+			value = constants[ops[frame->pc++]];
+			value = eval_var(frame->scope, (symbol_t)value);
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_CLOSURE:
+			value = constants[ops[frame->pc++]];
+			value = instantiate(frame->scope, (template_t)value);
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_DEFINE:
+		case OP_BIND:
+			value = pop_from_array(&VM.stack);
+			define(frame->scope,
+			       (symbol_t)constants[ops[frame->pc++]],
+			       value);
+			if (op == OP_DEFINE)
+				push_to_array(&VM.stack, wrap_nil());
+			break;
+
+		case OP_SET:
+			value = pop_from_array(&VM.stack);
+			set_in_scope(frame->scope,
+				     (symbol_t)constants[ops[frame->pc++]],
+				     value);
+			push_to_array(&VM.stack, wrap_nil());
+			break;
+
+		case OP_POP:
+			drop_values(1);
+			break;
+
+		case OP_JUMP:
+			frame->pc = ops[frame->pc];
+			break;
+
+		case OP_JUMP_UNLESS:
+			value = pop_from_array(&VM.stack);
+			at = ops[frame->pc++];
+			if (is_false(value))
+				frame->pc = at;
+			break;
+
+		case OP_AND:
+		case OP_OR:
+			value = *stack_top(1);
+			at = ops[frame->pc++];
+			if (is_true(value) == (op == OP_OR))
+				frame->pc = at;
+			else
+				drop_values(1);
+			break;
+
+		case OP_LET:
+			count = ops[frame->pc++];
+			scope = derive_scope(frame->scope);
+			for (int i = 0; i < count; i++) {
+				object_t name = constants[ops[frame->pc++]];
+				define(scope,
+				       (symbol_t)name,
+				       *stack_top(count - i));
+			}
+			drop_values(count);
+			frame->scope = scope;
+			break;
+
+		case OP_ENTER:
+			frame->scope = derive_scope(frame->scope);
+			break;
+
+		case OP_LEAVE:
+			frame->scope = frame->scope->parent;
+			break;
+
+		case OP_ARITH:
+			count = ops[frame->pc++];
+			func = constants[ops[frame->pc++]];
+			value = arith((global_t)func,
+				      count,
+				      *stack_top(2),
+				      *stack_top(1));
+			VM.stack.size -= 2;
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_CALL:
+			count = ops[frame->pc++];
+			func = *stack_top(count + 1);
+			if ((callee = compiled_lambda(func))) {
+				scope = bind_frame(
+					callee, count, stack_top(count));
+				drop_values(count + 1);
+				push_frame(callee->template, scope);
+				if (PROFILING)
+					profile_enter(callee);
+			} else {
+				value = call_foreign(func, count, false);
+				push_to_array(&VM.stack, value);
+			}
+			break;
+
+		case OP_TAIL_CALL:
+			count = ops[frame->pc++];
+			func = *stack_top(count + 1);
+			if ((callee = compiled_lambda(func))) {
+				scope = bind_frame(
+					callee, count, stack_top(count));
+				drop_values(count + 1);
+				*frame = (struct vm_frame){
+					callee->template, 0, scope};
+				if (PROFILING) {
+					profile_leave();
+					profile_enter(callee);
+				}
+				break;
+			}
+			value = call_foreign(
+				func, count, VM.depth - 1 == entry);
+			if (--VM.depth == entry)
+				return close_frame_with(mark, value);
+			if (PROFILING)
+				profile_leave();
+			push_to_array(&VM.stack, value);
+			break;
+
+		case OP_RETURN:
+			value = pop_from_array(&VM.stack);
+			if (--VM.depth == entry)
+				return close_frame_with(mark, value);
+			if (PROFILING)
+				profile_leave();
+			push_to_array(&VM.stack, value);
+			break;
+		}
+	}
+}
+
+//
+
+#include <time.h>
+
+#define MAX_TYPES 32
+
+_Thread_local struct gc_stats {
+	long minor_collections;
+	long major_collections;
+	long incremental_cycles;
+	long slices;
+	long compactions;
+	uint64_t mark_nsec;
+	uint64_t sweep_nsec;
+	uint64_t max_pause_nsec;
+	long peak_objects;
+	long allocated[MAX_TYPES];
+	long freed[MAX_TYPES];
+	long allocations;
+	uint64_t start_nsec;
+} GC_STATS;
+
+//
+// Type ids are the one thing all threads share: they index the per-type
+// counters above, and a type gets its id the first time any thread
+// allocates one, so handing them out takes a lock.
+//
+
+#include <pthread.h>
+
+struct type_ids {
+	pthread_mutex_t lock;
+	int count;
+	type_t types[MAX_TYPES];
+} TYPE_IDS = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+bool GC_REPORT;
+bool GC_SUMMARY;
+
+uint64_t clock_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void assign_type_id(type_t type, size_t size)
+{
+	pthread_mutex_lock(&TYPE_IDS.lock);
+	if (! type->id) {
+		ASSERT(TYPE_IDS.count + 1 < MAX_TYPES, "Too many types");
+		type->size = size;
+		TYPE_IDS.types[TYPE_IDS.count + 1] = type;
+		__atomic_store_n(&type->id, ++TYPE_IDS.count, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&TYPE_IDS.lock);
+}
+
+void count_allocation(type_t type, size_t size)
+{
+	if (! __atomic_load_n(&type->id, __ATOMIC_ACQUIRE))
+		assign_type_id(type, size);
+
+	GC_STATS.allocated[type->id]++;
+	GC_STATS.allocations++;
+
+	int live = ALL_OBJECTS.size + NURSERY.size + 1;
+	if (live > GC_STATS.peak_objects)
+		GC_STATS.peak_objects = live;
+}
+
+void count_compaction(void)
+{
+	GC_STATS.compactions++;
+}
+
+void count_disposal(type_t type)
+{
+	GC_STATS.freed[type->id]++;
+}
+
+void count_pause(uint64_t mark_nsec, uint64_t sweep_nsec)
+{
+	GC_STATS.mark_nsec += mark_nsec;
+	GC_STATS.sweep_nsec += sweep_nsec;
+	if (mark_nsec + sweep_nsec > GC_STATS.max_pause_nsec)
+		GC_STATS.max_pause_nsec = mark_nsec + sweep_nsec;
+}
+
+void count_major_collection(uint64_t mark_nsec, uint64_t sweep_nsec)
+{
+	GC_STATS.major_collections++;
+	count_pause(mark_nsec, sweep_nsec);
+}
+
+void count_minor_collection(uint64_t mark_nsec, uint64_t sweep_nsec)
+{
+	GC_STATS.minor_collections++;
+	count_pause(mark_nsec, sweep_nsec);
+}
+
+void count_slice(uint64_t mark_nsec, uint64_t sweep_nsec, bool finished)
+{
+	GC_STATS.slices++;
+	if (finished)
+		GC_STATS.incremental_cycles++;
+	count_pause(mark_nsec, sweep_nsec);
+}
+
+void write_gc_stats(FILE* out)
+{
+	fprintf(out, "minor collections: %ld\n", GC_STATS.minor_collections);
+	fprintf(out, "major collections: %ld\n", GC_STATS.major_collections);
+	fprintf(out,
+		"incremental cycles: %ld in %ld slices\n",
+		GC_STATS.incremental_cycles,
+		GC_STATS.slices);
+	fprintf(out,
+		"mark time: %.3f ms, sweep time: %.3f ms, max pause: %.3f ms\n",
+		GC_STATS.mark_nsec / 1e6,
+		GC_STATS.sweep_nsec / 1e6,
+		GC_STATS.max_pause_nsec / 1e6);
+	fprintf(out, "compactions: %ld\n", GC_STATS.compactions);
+	fprintf(out, "peak heap objects: %ld\n", GC_STATS.peak_objects);
+
+	for (int i = 1; i <= TYPE_IDS.count; i++) {
+		long allocated = GC_STATS.allocated[i];
+		long freed = GC_STATS.freed[i];
+		fprintf(out,
+			"%-10s %10ld allocated %10ld freed %10ld live\n",
+			TYPE_IDS.types[i]->name,
+			allocated,
+			freed,
+			allocated - freed);
+	}
+}
+
+// The same numbers on a single tab separated line, for the benchmark
+// scripts in `bench/` to collect and compare across builds.
+
+void write_gc_summary(FILE* out)
+{
+	long allocated = 0, freed = 0;
+	for (int i = 1; i <= TYPE_IDS.count; i++) {
+		allocated += GC_STATS.allocated[i];
+		freed += GC_STATS.freed[i];
+	}
+
+	fprintf(out,
+		"%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%.3f\t%.3f\t%.3f\t%.3f\n",
+		allocated,
+		freed,
+		GC_STATS.minor_collections,
+		GC_STATS.major_collections,
+		GC_STATS.slices,
+		GC_STATS.peak_objects,
+		GC_STATS.mark_nsec / 1e6,
+		GC_STATS.sweep_nsec / 1e6,
+		GC_STATS.max_pause_nsec / 1e6,
+		(clock_nsec() - GC_STATS.start_nsec) / 1e6);
+}
+
+void push_stat(object_t* list, const char* name, object_t value)
+{
+	push_to_list(list, wrap_pair(wrap_symbol(name), value));
+}
+
+object_t per_type_stats(long* counts)
+{
+	object_t result = wrap_nil();
+	for (int i = TYPE_IDS.count; i >= 1; i--)
+		push_stat(&result,
+			  TYPE_IDS.types[i]->name,
+			  wrap_long(counts[i]));
+	return result;
+}
+
+object_t native_gc_stats(int argct, object_t* args) // gc-stats
+{
+	assert_arg_count("gc-stats", argct, 0);
+
+	long live[MAX_TYPES];
+	for (int i = 0; i < MAX_TYPES; i++)
+		live[i] = GC_STATS.allocated[i] - GC_STATS.freed[i];
+
+	object_t result = wrap_nil();
+	push_stat(&result, "live", per_type_stats(live));
+	push_stat(&result, "freed", per_type_stats(GC_STATS.freed));
+	push_stat(&result, "allocated", per_type_stats(GC_STATS.allocated));
+	push_stat(&result, "compactions", wrap_long(GC_STATS.compactions));
+	push_stat(&result,
+		  "peak-heap-objects",
+		  wrap_long(GC_STATS.peak_objects));
+	push_stat(&result,
+		  "max-pause-usec",
+		  wrap_long(GC_STATS.max_pause_nsec / 1000));
+	push_stat(&result, "sweep-usec", wrap_long(GC_STATS.sweep_nsec / 1000));
+	push_stat(&result, "mark-usec", wrap_long(GC_STATS.mark_nsec / 1000));
+	push_stat(&result, "slices", wrap_long(GC_STATS.slices));
+	push_stat(&result,
+		  "incremental-cycles",
+		  wrap_long(GC_STATS.incremental_cycles));
+	push_stat(&result,
+		  "major-collections",
+		  wrap_long(GC_STATS.major_collections));
+	push_stat(&result,
+		  "minor-collections",
+		  wrap_long(GC_STATS.minor_collections));
+	return result;
+}
+
+//
+
+_Thread_local struct array REMEMBERED_OBJECTS;
+
+enum gc_mode {
+	GC_GENERATIONAL,
+	GC_INCREMENTAL,
+};
+
+enum gc_phase {
+	GC_IDLE,
+	GC_MARKING,
+	GC_SWEEPING,
+};
+
+_Thread_local enum gc_mode GC_MODE = GC_GENERATIONAL;
+_Thread_local enum gc_phase GC_PHASE = GC_IDLE;
+
+void write_barrier(object_t container, object_t old, object_t value)
+{
+	if (GC_PHASE == GC_MARKING) {
+		mark_reachable(old);
+		mark_reachable(value);
+		return;
+	}
+
+	if (GC_MODE != GC_GENERATIONAL)
+		return;
+	if (! value || is_immediate(value))
+		return;
+	if (container->gc_state != REACHED)
+		return;
+	if (value->gc_state != GARBAGE)
+		return;
+
+	container->gc_state = REMEMBERED;
+	push_to_array(&REMEMBERED_OBJECTS, container);
+}
+
+void count_minor_collection(uint64_t mark_nsec, uint64_t sweep_nsec);
+
+void collect_nursery(void)
+{
+	uint64_t start = clock_nsec();
+	REACHABLE_OBJECTS.size = 0;
+	mark_roots_from(HANDLES_SCANNED);
+
+	object_t obj;
+	while ((obj = pop_from_array(&REMEMBERED_OBJECTS))) {
+		set_gc_state(obj, REACHED);
+		if (obj->type->reach)
+			obj->type->reach(obj);
+	}
+
+	propagate_reachability();
+	uint64_t marked = clock_nsec();
+
+	for (int i = 0; i < NURSERY.size; i++) {
+		obj = NURSERY.data[i];
+		if (get_gc_state(obj) == REACHED)
+			push_to_array(&ALL_OBJECTS, obj);
+		else
+			dispose(obj);
+	}
+
+	NURSERY.size = 0;
+	count_minor_collection(marked - start, clock_nsec() - marked);
+}
+
+//
+
+#define GC_SLICE_ALLOCS 256
+#define GC_CLOCK_STRIDE 64
+
+_Thread_local long GC_PAUSE_USEC;
+
+_Thread_local struct incremental_gc {
+	int threshold;
+	int allocs;
+	int scan;
+	int keep;
+	int limit;
+	struct timespec deadline;
+} INCREMENTAL = {
+	.threshold = 100,
+};
+
+void set_deadline(struct timespec* ts, long usec)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_nsec += usec * 1000;
+	ts->tv_sec += ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+bool past_deadline(int work)
+{
+	if (work % GC_CLOCK_STRIDE != 0)
+		return false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != INCREMENTAL.deadline.tv_sec)
+		return now.tv_sec > INCREMENTAL.deadline.tv_sec;
+	return now.tv_nsec >= INCREMENTAL.deadline.tv_nsec;
+}
+
+void start_cycle(void)
+{
+	REACHABLE_OBJECTS.size = 0;
+	mark_roots();
+	GC_PHASE = GC_MARKING;
+}
+
+bool mark_slice(bool bounded, int* work)
+{
+	object_t obj;
+	while ((obj = pop_from_array(&REACHABLE_OBJECTS))) {
+		if (get_gc_state(obj) == REACHABLE)
+			reach(obj);
+		if (bounded && past_deadline(++*work))
+			return false;
+	}
+
+	INCREMENTAL.keep = 0;
+	INCREMENTAL.scan = 0;
+	INCREMENTAL.limit = ALL_OBJECTS.size;
+	GC_PHASE = GC_SWEEPING;
+	return true;
+}
+
+bool sweep_slice(bool bounded, int* work)
+{
+	while (INCREMENTAL.scan < INCREMENTAL.limit) {
+		object_t obj = ALL_OBJECTS.data[INCREMENTAL.scan++];
+		if (get_gc_state(obj) == REACHED) {
+			set_gc_state(obj, GARBAGE);
+			ALL_OBJECTS.data[INCREMENTAL.keep++] = obj;
+		} else {
+			dispose(obj);
+		}
+		if (bounded && past_deadline(++*work))
+			return false;
+	}
+
+	int tail = ALL_OBJECTS.size - INCREMENTAL.limit;
+	memmove(&ALL_OBJECTS.data[INCREMENTAL.keep],
+		&ALL_OBJECTS.data[INCREMENTAL.limit],
+		tail * sizeof(object_t));
+	ALL_OBJECTS.size = INCREMENTAL.keep + tail;
+
+	INCREMENTAL.threshold = ALL_OBJECTS.size * 2;
+	GC_PHASE = GC_IDLE;
+	return true;
+}
+
+void count_slice(uint64_t mark_nsec, uint64_t sweep_nsec, bool finished);
+
+void collect_slice(bool bounded)
+{
+	int work = 0;
+	uint64_t start = clock_nsec(), marked = start;
+
+	if (bounded)
+		set_deadline(&INCREMENTAL.deadline, GC_PAUSE_USEC);
+
+	if (GC_PHASE == GC_MARKING) {
+		bool done = mark_slice(bounded, &work);
+		marked = clock_nsec();
+		if (! done) {
+			count_slice(marked - start, 0, false);
+			return;
+		}
+	}
+
+	bool finished = sweep_slice(bounded, &work);
+	count_slice(marked - start, clock_nsec() - marked, finished);
+}
+
+bool register_incrementally(object_t obj)
+{
+	if (GC_MODE != GC_INCREMENTAL)
+		return false;
+
+	if ((GC_PHASE == GC_IDLE) &&
+	    (ALL_OBJECTS.size > INCREMENTAL.threshold))
+		start_cycle();
+
+	if ((GC_PHASE != GC_IDLE) &&
+	    (++INCREMENTAL.allocs >= GC_SLICE_ALLOCS)) {
+		INCREMENTAL.allocs = 0;
+		bool runaway = ALL_OBJECTS.size > INCREMENTAL.threshold * 4;
+		collect_slice(! runaway);
+	}
+
+	if (GC_PHASE == GC_MARKING) {
+		set_gc_state(obj, REACHABLE);
+		push_to_array(&REACHABLE_OBJECTS, obj);
+	} else {
+		set_gc_state(obj, GARBAGE);
+	}
+
+	push_to_array(&ALL_OBJECTS, obj);
+	return true;
+}
+
+void finish_collection(void)
+{
+	while (GC_PHASE != GC_IDLE)
+		collect_slice(false);
+}
+
+void enable_incremental_gc(long pause_usec)
+{
+	ASSERT(pause_usec > 0, "GC pause budget must be positive");
+	GC_PAUSE_USEC = pause_usec;
+
+	if (GC_MODE == GC_INCREMENTAL)
+		return;
+
+	collect_nursery();
+	collect_garbage();
+	for (int i = 0; i < ALL_OBJECTS.size; i++)
+		set_gc_state(ALL_OBJECTS.data[i], GARBAGE);
+	INCREMENTAL.threshold = ALL_OBJECTS.size * 2;
+	GC_MODE = GC_INCREMENTAL;
+}
+
+//
+
+#define POOL_GRANULE 16
+#define POOL_CLASSES 8
+#define SLAB_BYTES 16384
+
+struct slab {
+	struct slab* next;
+	size_t padding;
+};
+
+struct pool {
+	void* free;
+	struct slab* slabs;
+	int capacity;
+	int used;
+};
+
+_Thread_local struct pool POOLS[POOL_CLASSES];
+
+struct pool* pool_for(size_t size)
+{
+	if ((size == 0) || (size > POOL_GRANULE * POOL_CLASSES))
+		return NULL;
+	return &POOLS[(size - 1) / POOL_GRANULE];
+}
+
+size_t pool_slot_size(struct pool* pool)
+{
+	return (pool - POOLS + 1) * POOL_GRANULE;
+}
+
+void refill_pool(struct pool* pool)
+{
+	size_t size = pool_slot_size(pool);
+	int count = (SLAB_BYTES - sizeof(struct slab)) / size;
+
+	struct slab* slab = malloc(SLAB_BYTES);
+	if (! slab)
+		DIE("Out of memory");
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	char* data = (char*)(slab + 1);
+	for (int i = count - 1; i >= 0; i--) {
+		void** slot = (void**)(data + i * size);
+		*slot = pool->free;
+		pool->free = slot;
+	}
+	pool->capacity += count;
+}
+
+void* alloc_slot(size_t size)
+{
+	struct pool* pool = pool_for(size);
+	if (! pool) {
+		void* ptr = malloc(size);
+		if (! ptr)
+			DIE("Out of memory");
+		return ptr;
+	}
+
+	if (! pool->free)
+		refill_pool(pool);
+
+	void** slot = pool->free;
+	pool->free = *slot;
+	pool->used++;
+	return slot;
+}
+
+void release_slot(void* ptr, size_t size)
+{
+	struct pool* pool = pool_for(size);
+	if (! pool) {
+		free(ptr);
+		return;
+	}
+
+	void** slot = ptr;
+	*slot = pool->free;
+	pool->free = slot;
+	pool->used--;
+}
+
+void dispose_pools(void)
+{
+	for (int i = 0; i < POOL_CLASSES; i++) {
+		struct slab* slab = POOLS[i].slabs;
+		while (slab) {
+			struct slab* next = slab->next;
+			free(slab);
+			slab = next;
+		}
+	}
+	bzero(POOLS, sizeof(POOLS));
+}
+
+void write_pool_stats(FILE* out)
+{
+	for (int i = 0; i < POOL_CLASSES; i++) {
+		struct pool* pool = &POOLS[i];
+		if (pool->capacity == 0)
+			continue;
+		fprintf(out,
+			"pool %3zu: %7d / %7d slots in use\n",
+			pool_slot_size(pool),
+			pool->used,
+			pool->capacity);
+	}
+}
+
+//
+// Pairs land in whatever slot the pool had free, so after a few
+// collections a long list is scattered all over the place, and walking
+// it means a cache miss for every cell. Compaction moves live pairs into
+// fresh slabs in list order: each pair is followed by its `cdr`, by the
+// `cdr` of that and so on, and only then by what the `car`s point to
+// (which is Cheney's copying scan done `cdr` first).
+//
+// Moving an object means fixing every pointer to it, and only pointers
+// the collector knows about can be fixed. Pairs with a handle get pinned
+// for the duration, so those stay where they are, but a C function
+// walking a list doesn't hold every cell it looks at. That's why
+// compaction only happens where no such walk can be going on: between
+// top level forms, and between the thunks of a top level form's own
+// trampoline.
+//
+
+bool COMPACT = false;
+
+_Thread_local struct compaction {
+	struct pool* pool;
+	char* next;
+	char* end;
+	struct array copies;
+	long cycles;
+} COMPACTION;
+
+void add_compaction_slab(void)
+{
+	struct pool* pool = COMPACTION.pool;
+	struct slab* slab = malloc(SLAB_BYTES);
+	if (! slab)
+		DIE("Out of memory");
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	size_t size = pool_slot_size(pool);
+	int count = (SLAB_BYTES - sizeof(struct slab)) / size;
+	COMPACTION.next = (char*)(slab + 1);
+	COMPACTION.end = COMPACTION.next + count * size;
+}
+
+pair_t copy_pair(pair_t pair)
+{
+	if (COMPACTION.next == COMPACTION.end)
+		add_compaction_slab();
+
+	pair_t copy = (pair_t)COMPACTION.next;
+	COMPACTION.next += pool_slot_size(COMPACTION.pool);
+	*copy = *pair;
+	copy->self.gc_state = GARBAGE;
+	push_to_array(&COMPACTION.copies, (object_t)copy);
+
+	pair->self.gc_state = FORWARDED;
+	pair->car = (object_t)copy;
+	return copy;
+}
+
+bool is_movable(object_t obj)
+{
+	return to_pair(obj) && obj->gc_state == REACHED && ! obj->pins;
+}
+
+object_t evacuate(object_t obj)
+{
+	pair_t pair = obj ? to_pair(obj) : NULL;
+	if (! pair)
+		return obj;
+	if (obj->gc_state == FORWARDED)
+		return car(pair);
+	if (! is_movable(obj))
+		return obj;
+
+	pair_t head = copy_pair(pair), last = head;
+	while (is_movable(last->cdr)) {
+		last->cdr = (object_t)copy_pair((pair_t)last->cdr);
+		last = (pair_t)last->cdr;
+	}
+	return (object_t)head;
+}
+
+//
+// Before anything moves, a full collection makes sure every object left
+// is alive and `REACHED`, so that `mark_reachable()` calls in the
+// `reach_*()` functions have nothing to do. Then every object that stays
+// in place gets its fields fixed, which moves whatever they point to, and
+// the copies get their fields fixed in turn.
+//
+
+void drain_copies(int* scan)
+{
+	while (*scan < COMPACTION.copies.size)
+		reach_pair(COMPACTION.copies.data[(*scan)++]);
+}
+
+void move_pairs(void)
+{
+	int scan = 0;
+
+	for (int i = 0; i < STACK_SCOPES.size; i++)
+		reach_scope(STACK_SCOPES.data[i]);
+
+	for (int i = 0; i < ALL_OBJECTS.size; i++) {
+		object_t obj = ALL_OBJECTS.data[i];
+		if (obj->gc_state == FORWARDED || is_movable(obj))
+			continue;
+		if (obj->type->reach)
+			obj->type->reach(obj);
+		drain_copies(&scan);
+	}
+
+	for (int i = 0; i < ALL_OBJECTS.size; i++) {
+		object_t obj = ALL_OBJECTS.data[i];
+		if (is_movable(obj))
+			reach_pair(obj);
+		drain_copies(&scan);
+	}
+}
+
+//
+// (The second loop is there for pairs nothing in the heap points to, like
+// the ones only a handle holds onto; they don't move, but what they
+// point to might.)
+//
+// Afterwards, the pool gets its free list built anew: every slot that
+// isn't taken by a live object is free, and slabs left with no live
+// objects at all go back to `malloc()`. Live objects of the pool's size
+// and its slabs get sorted by address, so that's one walk over both.
+//
+
+size_t object_size(object_t obj)
+{
+	type_t type = obj->type;
+	return type->measure ? type->measure(obj) : type->size;
+}
+
+int compare_addresses(const void* a, const void* b)
+{
+	uintptr_t x = *(uintptr_t*)a, y = *(uintptr_t*)b;
+	return (x > y) - (x < y);
+}
+
+void rebuild_pool(struct pool* pool, struct array* objects)
+{
+	struct array live, slabs;
+	init_array(&live);
+	init_array(&slabs);
+
+	for (int i = 0; i < objects->size; i++)
+		if (pool_for(object_size(objects->data[i])) == pool)
+			push_to_array(&live, objects->data[i]);
+	for (struct slab* slab = pool->slabs; slab; slab = slab->next)
+		push_to_array(&slabs, (object_t)slab);
+
+	qsort(live.data, live.size, sizeof(object_t), compare_addresses);
+	qsort(slabs.data, slabs.size, sizeof(object_t), compare_addresses);
+
+	size_t size = pool_slot_size(pool);
+	int count = (SLAB_BYTES - sizeof(struct slab)) / size, taken = 0;
+	void** tail = &pool->free;
+	struct slab** kept = &pool->slabs;
+	pool->capacity = 0;
+
+	for (int i = 0; i < slabs.size; i++) {
+		struct slab* slab = (struct slab*)slabs.data[i];
+		char* data = (char*)(slab + 1);
+		void** first = tail;
+		int before = taken;
+
+		for (int j = 0; j < count; j++) {
+			object_t slot = (object_t)(data + j * size);
+			if (taken < live.size && live.data[taken] == slot) {
+				taken++;
+				continue;
+			}
+			*tail = slot;
+			tail = (void**)slot;
+		}
+
+		if (taken == before) {
+			tail = first;
+			free(slab);
+			continue;
+		}
+
+		*kept = slab;
+		kept = &slab->next;
+		pool->capacity += count;
+	}
+
+	ASSERT(taken == live.size, "A live object outside of its pool's slabs");
+	*tail = NULL;
+	*kept = NULL;
+	pool->used = taken;
+	dispose_array(&live);
+	dispose_array(&slabs);
+}
+
+void count_compaction(void);
+
+void compact_heap(void)
+{
+	finish_collection();
+	collect_nursery();
+	collect_garbage();
+
+	COMPACTION.pool = pool_for(sizeof(struct pair));
+	COMPACTION.next = COMPACTION.end = NULL;
+	init_array(&COMPACTION.copies);
+
+	// Pointers on the C side can't be fixed, so what they point to stays
+	visit_roots(pin, 0);
+	COMPACTING = true;
+	move_pairs();
+	COMPACTING = false;
+	visit_roots(unpin, 0);
+
+	enum gc_state rest = GC_MODE == GC_INCREMENTAL ? GARBAGE : REACHED;
+	for (int i = 0; i < ALL_OBJECTS.size; i++) {
+		object_t obj = ALL_OBJECTS.data[i];
+		if (obj->gc_state == FORWARDED)
+			obj = ALL_OBJECTS.data[i] = car((pair_t)obj);
+		obj->gc_state = rest;
+	}
+
+	rebuild_pool(COMPACTION.pool, &ALL_OBJECTS);
+	dispose_array(&COMPACTION.copies);
+
+	// Globals remember what they found, and that may have moved
+	BINDINGS_VERSION++;
+	count_compaction();
+}
+
+//
+// Once a collection or two has happened since the last compaction, the
+// next gap between top level forms is as good a time as any.
+//
+
+void compact_if_due(void)
+{
+	if (! COMPACT)
+		return;
+
+	long cycles = GC_STATS.major_collections + GC_STATS.incremental_cycles;
+	if (cycles == COMPACTION.cycles)
+		return;
+
+	compact_heap();
+	COMPACTION.cycles =
+		GC_STATS.major_collections + GC_STATS.incremental_cycles;
+}
+
+//
+// A form that loops forever never gives the heap a gap, though. But a
+// loop is a tail call, and the trampoline that `eval_repl()` runs is
+// what gets to it: nothing is on the C stack above that one but the
+// loop reading top level forms, and the pending call's lambda and
+// arguments are counted, so they stay put. That makes the moment between
+// two of its thunks just as good as the gap between two forms. (Any
+// deeper trampoline, like the one a native `map` calls a function
+// through, is right under a C function walking a list, so it's not. Nor
+// is a loop the VM runs: its tail calls never leave `run_vm()`, so under
+// `--vm` it's still only between forms.)
+//
+
+object_t force_at_top_level(object_t value)
+{
+	int frame = open_frame();
+	thunk_t thunk;
+
+	while ((thunk = to_thunk(value))) {
+		value = close_frame_with(frame, eval_thunk(thunk));
+		compact_if_due();
+	}
+
+	return value;
+}
+
+object_t native_pool_stats(int argct, object_t* args) // pool-stats
+{
+	assert_arg_count("pool-stats", argct, 0);
+	object_t result = wrap_nil();
+
+	for (int i = POOL_CLASSES - 1; i >= 0; i--) {
+		struct pool* pool = &POOLS[i];
+		if (pool->capacity == 0)
+			continue;
+
+		object_t row = wrap_nil();
+		object_t cells[] = {
+			wrap_int(pool_slot_size(pool)),
+			wrap_int(pool->used),
+			wrap_int(pool->capacity),
+		};
+		for (int j = 2; j >= 0; j--)
+			push_to_list(&row, cells[j]);
+		push_to_list(&result, row);
+	}
+
+	return result;
+}
+
+//
+// The profiler keeps one record per lambda body and a stack of the calls
+// currently running. Going by the body rather than the name keeps two
+// anonymous lambdas, or two functions that happen to share a label, apart.
+// Each call charges its time and allocations to the record as self cost,
+// minus whatever its callees used, and to every caller on the stack as
+// inclusive cost. A tail call finishes its caller before it starts, so the
+// caller's inclusive numbers stop right there.
+//
+
+struct profile_record {
+	object_t code;
+	char* name;
+	long calls;
+	int active;
+	uint64_t self_nsec;
+	uint64_t total_nsec;
+	long self_allocations;
+	long total_allocations;
+};
+
+struct profile_call {
+	struct profile_record* record;
+	uint64_t started;
+	uint64_t child_nsec;
+	long allocations;
+	long child_allocations;
+};
+
+_Thread_local struct profiler {
+	struct profile_record** records;
+	int count;
+	int mask;
+	struct profile_call* calls;
+	int depth;
+	int depth_avail;
+} PROFILER;
+
+int profile_slot(struct profile_record** records, int mask, object_t code)
+{
+	int index = ((uintptr_t)code >> 4) & mask;
+	while (records[index] && records[index]->code != code)
+		index = (index + 1) & mask;
+	return index;
+}
+
+void grow_profile_records(void)
+{
+	int mask = PROFILER.mask ? PROFILER.mask * 2 + 1 : 63;
+	struct profile_record** records = calloc(mask + 1, sizeof(*records));
+	for (int i = 0; PROFILER.mask && i <= PROFILER.mask; i++) {
+		struct profile_record* record = PROFILER.records[i];
+		if (record)
+			records[profile_slot(records, mask, record->code)] =
+				record;
+	}
+
+	free(PROFILER.records);
+	PROFILER.records = records;
+	PROFILER.mask = mask;
+}
+
+char* profile_name(lambda_t lambda)
+{
+	if (lambda->label)
+		return strdup(unwrap_symbol(lambda->label));
+
+	char* name;
+	size_t length;
+	FILE* out = open_memstream(&name, &length);
+	fputs("(lambda", out);
+	if (lambda->template) {
+		fputc(' ', out);
+		write_object(out, lambda->template->params);
+	}
+	fputc(')', out);
+	fclose(out);
+	return name;
+}
+
+struct profile_record* find_profile_record(lambda_t lambda)
+{
+	if (2 * (PROFILER.count + 1) > PROFILER.mask)
+		grow_profile_records();
+
+	object_t code = lambda->body;
+	int index = profile_slot(PROFILER.records, PROFILER.mask, code);
+	struct profile_record* record = PROFILER.records[index];
+	if (record)
+		return record;
+
+	// Holding on to the body keeps its address from being reused
+	pin(code);
+	record = calloc(1, sizeof(*record));
+	record->code = code;
+	record->name = profile_name(lambda);
+	PROFILER.records[index] = record;
+	PROFILER.count++;
+	return record;
+}
+
+void profile_enter(lambda_t lambda)
+{
+	if (PROFILER.depth == PROFILER.depth_avail) {
+		PROFILER.depth_avail =
+			PROFILER.depth_avail ? PROFILER.depth_avail * 2 : 64;
+		PROFILER.calls =
+			realloc(PROFILER.calls,
+				PROFILER.depth_avail * sizeof(*PROFILER.calls));
+	}
+
+	struct profile_record* record = find_profile_record(lambda);
+	record->calls++;
+	record->active++;
+	PROFILER.calls[PROFILER.depth++] = (struct profile_call){
+		.record = record,
+		.started = clock_nsec(),
+		.allocations = GC_STATS.allocations,
+	};
+}
+
+void profile_leave(void)
+{
+	// Calls that were already running when profiling started
+	if (PROFILER.depth == 0)
+		return;
+
+	struct profile_call* call = &PROFILER.calls[--PROFILER.depth];
+	struct profile_record* record = call->record;
+	uint64_t nsec = clock_nsec() - call->started;
+	long allocations = GC_STATS.allocations - call->allocations;
+
+	record->self_nsec += nsec - call->child_nsec;
+	record->self_allocations += allocations - call->child_allocations;
+	if (--record->active == 0) {
+		record->total_nsec += nsec;
+		record->total_allocations += allocations;
+	}
+
+	if (PROFILER.depth > 0) {
+		struct profile_call* caller = call - 1;
+		caller->child_nsec += nsec;
+		caller->child_allocations += allocations;
+	}
+}
+
+void reset_profiler(void)
+{
+	for (int i = 0; PROFILER.mask && i <= PROFILER.mask; i++) {
+		struct profile_record* record = PROFILER.records[i];
+		if (record) {
+			unpin(record->code);
+			free(record->name);
+			free(record);
+			PROFILER.records[i] = NULL;
+		}
+	}
+	PROFILER.count = 0;
+	PROFILER.depth = 0;
+}
+
+void dispose_profiler(void)
+{
+	reset_profiler();
+	free(PROFILER.records);
+	free(PROFILER.calls);
+	PROFILER = (struct profiler){0};
+}
+
+int compare_profile_records(const void* a, const void* b)
+{
+	const struct profile_record* x = *(struct profile_record**)a;
+	const struct profile_record* y = *(struct profile_record**)b;
+	if (x->self_nsec != y->self_nsec)
+		return x->self_nsec < y->self_nsec ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+void write_profile(FILE* out)
+{
+	struct profile_record** sorted =
+		malloc(PROFILER.count * sizeof(*sorted));
+	for (int i = 0, j = 0; PROFILER.mask && i <= PROFILER.mask; i++)
+		if (PROFILER.records[i])
+			sorted[j++] = PROFILER.records[i];
+	qsort(sorted, PROFILER.count, sizeof(*sorted), compare_profile_records);
+
+	fprintf(out,
+		"%10s %10s %10s %10s %10s  %s\n",
+		"calls",
+		"self ms",
+		"total ms",
+		"self alloc",
+		"total alloc",
+		"name");
+	for (int i = 0; i < PROFILER.count; i++) {
+		struct profile_record* record = sorted[i];
+		fprintf(out,
+			"%10ld %10.3f %10.3f %10ld %10ld  %s\n",
+			record->calls,
+			record->self_nsec / 1e6,
+			record->total_nsec / 1e6,
+			record->self_allocations,
+			record->total_allocations,
+			record->name);
+	}
+	free(sorted);
+}
+
+object_t native_profile_start(int argct, object_t* args) // profile-start
+{
+	assert_arg_count("profile-start", argct, 0);
+	reset_profiler();
+	PROFILING = true;
+	return wrap_nil();
+}
+
+object_t native_profile_report(int argct, object_t* args) // profile-report
+{
+	assert_arg_count("profile-report", argct, 0);
+	write_profile(current_output());
+	return wrap_nil();
+}
+
+//
+
+long parse_pause(const char* text)
+{
+	char* end;
+	long usec = strtol(text, &end, 10);
+	if ((*end != '\0') || (usec <= 0))
+		DIE("Invalid GC pause budget: %s", text);
+	return usec;
+}
+
+int parse_jobs(const char* text)
+{
+	char* end;
+	long jobs = strtol(text, &end, 10);
+	if ((*end != '\0') || (jobs <= 0) || (jobs > 1024))
+		DIE("Invalid number of jobs: %s", text);
+	return jobs;
+}
+
+int JOBS = 1;
+bool PROFILE_REPORT = false;
+const char* IMAGE_PATH = NULL;
+const char* SAVE_IMAGE_PATH = NULL;
+const char* SERVE_PATH = NULL;
+const char* CONNECT_PATH = NULL;
+
+int parse_options(int argc, const char** argv)
+{
+	int index = 1;
+
+	for (; index < argc; index++) {
+		const char* arg = argv[index];
+		if (strncmp(arg, "--", 2) != 0)
+			break;
+
+		if (strcmp(arg, "--") == 0)
+			return index + 1;
+		else if (strncmp(arg, "--gc-pause=", 11) == 0)
+			enable_incremental_gc(parse_pause(arg + 11));
+		else if (strcmp(arg, "--gc-stats") == 0)
+			GC_REPORT = true;
+		else if (strcmp(arg, "--gc-summary") == 0)
+			GC_SUMMARY = true;
+		else if (strcmp(arg, "--compact") == 0)
+			COMPACT = true;
+		else if (strcmp(arg, "--profile") == 0)
+			PROFILE_REPORT = PROFILING = true;
+		else if (strcmp(arg, "--vm") == 0)
+			USE_VM = true;
+		else if (strncmp(arg, "--jobs=", 7) == 0)
+			JOBS = parse_jobs(arg + 7);
+		else if (strncmp(arg, "--image=", 8) == 0)
+			IMAGE_PATH = arg + 8;
+		else if (strncmp(arg, "--save-image=", 13) == 0)
+			SAVE_IMAGE_PATH = arg + 13;
+		else if (strncmp(arg, "--serve=", 8) == 0)
+			SERVE_PATH = arg + 8;
+		else if (strncmp(arg, "--connect=", 10) == 0)
+			CONNECT_PATH = arg + 10;
+		else
+			DIE("Unknown option %s", arg);
+	}
+
+	return index;
+}
+
+//
+
+enum thread_role {
+	MAIN_THREAD,
+	JOB_THREAD,
+	POOL_THREAD,
+};
+
+_Thread_local enum thread_role ROLE = MAIN_THREAD;
+
+#define PORT_BUFFER (1 << 16)
+
+void register_builtins(void);
+
+void setup_runtime()
+{
+	GC_STATS.start_nsec = clock_nsec();
+	init_array(&ALL_OBJECTS);
+	init_array(&NURSERY);
+	init_array(&REACHABLE_OBJECTS);
+	init_array(&REMEMBERED_OBJECTS);
+	init_array(&HANDLES);
+	init_array(&PINNED);
+	init_array(&STACK_SCOPES);
+	init_array(&VM.stack);
+	init_dict(&BUILTINS);
+
+	// Result dumps can be big, and they only need flushing at the end
+	if (ROLE == MAIN_THREAD && ! isatty(fileno(stdout)))
+		setvbuf(stdout, NULL, _IOFBF, PORT_BUFFER);
+
+	const char* pause = getenv("SCHEME_GC_PAUSE");
+	if (pause)
+		enable_incremental_gc(parse_pause(pause));
+	if (getenv("SCHEME_GC_STATS"))
+		GC_REPORT = true;
+	if (getenv("SCHEME_COMPACT"))
+		COMPACT = true;
+	if (getenv("SCHEME_VM"))
+		USE_VM = true;
+	if (getenv("SCHEME_IMAGE"))
+		IMAGE_PATH = getenv("SCHEME_IMAGE");
+	if (getenv("SCHEME_PROFILE"))
+		PROFILE_REPORT = true;
+	PROFILING = PROFILE_REPORT;
+
+	int frame = open_frame();
+	register_builtins();
+	STACK_SYNTAX.let = wrap_syntax("stack-let", syntax_stack_let);
+	STACK_SYNTAX.letrec = wrap_syntax("stack-letrec", syntax_stack_letrec);
+	close_frame(frame);
+}
+
+//
+
+void stop_future_pool(void);
+void release_globals(void);
+
+void teardown_runtime()
+{
+	if (ROLE == MAIN_THREAD)
+		stop_future_pool();
+	release_globals();
+
+	bool report = ROLE != POOL_THREAD;
+	if (GC_REPORT && report)
+		write_gc_stats(stderr);
+	if (GC_SUMMARY && report)
+		write_gc_summary(stderr);
+	if (PROFILE_REPORT && report)
+		write_profile(stderr);
+	dispose_profiler();
+	dispose_arg_stack();
+	free(PENDING_CALL.args);
+	PENDING_CALL = (struct thunk){.self = PENDING_CALL.self};
+
+	release_builtins();
+	unpin((object_t)get_repl_scope());
+	unpin((object_t)get_symbol_pool());
+	REPL_SCOPE = SYMBOL_POOL = NULL;
+
+	// Whatever a job was in the middle of when it died goes as well
+	close_frame(0);
+	VM.depth = VM.stack.size = 0;
+	finish_collection();
+	collect_nursery();
+	collect_garbage();
+	if (getenv("SCHEME_POOL_STATS"))
+		write_pool_stats(stderr);
+	dispose_array(&ALL_OBJECTS);
+	dispose_array(&NURSERY);
+	dispose_array(&REACHABLE_OBJECTS);
+	dispose_array(&REMEMBERED_OBJECTS);
+	dispose_array(&HANDLES);
+	dispose_array(&PINNED);
+	dispose_array(&STACK_SCOPES);
+	dispose_array(&VM.stack);
+	free(VM.frames);
+	dispose_pools();
+
+	// A thread may set up another runtime after this one
+	VM = (struct vm){0};
+	GC_STATS = (struct gc_stats){0};
+	GC_MODE = GC_GENERATIONAL;
+	INCREMENTAL = (struct incremental_gc){.threshold = 100};
+	COMPACTION = (struct compaction){0};
+}
+
+//
+// A script that dies is exactly the one whose profile you want to see, so
+// `DIE()` writes the report on its way out too, after charging the calls
+// that were still running with the time they took so far.
+//
+// A job (more on those later) doesn't get to take the whole process down
+// with it, though. It sets `DIE_RECOVERY`, and dying just jumps back there,
+// leaving the report to the job's own teardown.
+//
+
+#include <setjmp.h>
+
+_Thread_local jmp_buf* DIE_RECOVERY = NULL;
+
+void die(void)
+{
+	static _Thread_local bool dying = false;
+	if (dying)
+		abort();
+	dying = true;
+
+	while (PROFILER.depth > 0)
+		profile_leave();
+	if (DIE_RECOVERY) {
+		dying = false;
+		longjmp(*DIE_RECOVERY, 1);
+	}
+	if (PROFILE_REPORT && ROLE != POOL_THREAD)
+		write_profile(stderr);
+	abort();
+}
+
+object_t pop_from_list_or_die(object_t* ptr)
+{
+	object_t result = pop_from_list(ptr);
+	if (! result)
+		DIE("Premature end of list");
+	return result;
+}
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct source {
+	const char* pos;
+	const char* end;
+};
+
+typedef struct source* source_t;
+
+int skip_source(source_t src)
+{
+	while (src->pos < src->end) {
+		char ch = *src->pos;
+		if (ch == ';') {
+			int left = src->end - src->pos;
+			const char* eol = memchr(src->pos, '\n', left);
+			src->pos = eol ? eol : src->end;
+		} else if (isspace(ch))
+			src->pos++;
+		else
+			return (unsigned char)ch;
+	}
+	return EOF;
+}
+
+object_t scan_object(source_t src);
+
+object_t scan_list(source_t src)
+{
+	object_t accum = wrap_nil(), obj;
+
+	for (;;) {
+		int ch = skip_source(src);
+		if (ch == EOF)
+			DIE("Premature end of input");
+		if (ch == ')') {
+			src->pos++;
+			break;
+		}
+		obj = scan_object(src);
+		push_to_list(&accum, obj);
+	}
+
+	return reverse_read_list(accum);
+}
+
+object_t scan_quote(source_t src)
+{
+	object_t obj = scan_object(src);
+	if (! obj)
+		DIE("Premature end of input");
+
+	object_t result = wrap_nil();
+	push_to_list(&result, obj);
+	push_to_list(&result, wrap_symbol("quote"));
+	return result;
+}
+
+object_t wrap_owned_string(char* value, int length)
+{
+	string_t str = alloc_object(&TYPE_STRING, sizeof(*str));
+	str->value = value;
+	str->length = length;
+	str->capacity = length;
+	return (object_t)str;
+}
+
+string_t alloc_string(type_t type, int capacity)
+{
+	string_t str = alloc_object(type, sizeof(*str));
+	str->value = malloc(capacity + 1);
+	str->value[0] = '\0';
+	str->length = 0;
+	str->capacity = capacity;
+	return str;
+}
+
+void append_to_string(string_t str, const char* text, int len)
+{
+	int length = str->length + len;
+	if (length > str->capacity) {
+		int capacity = str->capacity * 2;
+		if (capacity < length)
+			capacity = length;
+		str->value = realloc(str->value, capacity + 1);
+		str->capacity = capacity;
+	}
+	memcpy(str->value + str->length, text, len);
+	str->length = length;
+	str->value[length] = '\0';
+}
+
+struct type TYPE_STRING_BUILDER = {
+	.name = "string-builder",
+	.dispose = dispose_string,
+};
+
+struct vector {
+	struct object self;
+	struct array items;
+};
+
+typedef struct vector* vector_t;
+
+void reach_vector(object_t obj)
+{
+	vector_t vector = (vector_t)obj;
+	object_t* items = vector->items.data;
+	for (int i = vector->items.size - 1; i >= 0; i--)
+		reach_field(&items[i]);
+}
+
+void dispose_vector(object_t obj)
+{
+	vector_t vector = (vector_t)obj;
+	dispose_array(&vector->items);
+}
+
+void write_vector(FILE* out, object_t obj)
+{
+	vector_t vector = (vector_t)obj;
+
+	fputs("#(", out);
+	for (int i = 0; i < vector->items.size; i++) {
+		if (i > 0)
+			fputs(" ", out);
+		write_object(out, vector->items.data[i]);
+	}
+	fputs(")", out);
+}
+
+struct type TYPE_VECTOR = {
+	.name = "vector",
+	.dispose = dispose_vector,
+	.reach = reach_vector,
+	.write = write_vector,
+};
+
+vector_t wrap_vector(int size, object_t fill)
+{
+	vector_t vector = alloc_object(&TYPE_VECTOR, sizeof(*vector));
+	init_array(&vector->items);
+	for (int i = 0; i < size; i++)
+		push_to_array(&vector->items, fill);
+	return vector;
+}
+
+vector_t to_vector(object_t obj)
+{
+	if (type_of(obj) == &TYPE_VECTOR)
+		return (vector_t)obj;
+	return NULL;
+}
+
+struct table_entry {
+	object_t key;
+	object_t value;
+	unsigned int hash;
+};
+
+struct slots {
+	struct table_entry* data;
+	unsigned int size;
+	unsigned int used;
+	unsigned int filled;
+};
+
+struct table {
+	struct object self;
+	struct slots live;
+	struct slots old;
+	unsigned int moved;
+};
+
+typedef struct table* table_t;
+
+struct object TOMBSTONE;
+
+#define IS_ENTRY(entry) ((entry)->key && (entry)->key != &TOMBSTONE)
+
+void reach_slots(struct slots* slots)
+{
+	for (int i = slots->size - 1; i >= 0; i--) {
+		struct table_entry* entry = &slots->data[i];
+		if (IS_ENTRY(entry)) {
+			mark_reachable(entry->key);
+			reach_field(&entry->value);
+		}
+	}
+}
+
+void reach_table(object_t obj)
+{
+	table_t table = (table_t)obj;
+	reach_slots(&table->live);
+	reach_slots(&table->old);
+}
+
+void dispose_table(object_t obj)
+{
+	table_t table = (table_t)obj;
+	free(table->live.data);
+	free(table->old.data);
+}
+
+struct type TYPE_TABLE = {
+	.name = "hash-table",
+	.dispose = dispose_table,
+	.reach = reach_table,
+};
+
+table_t to_table(object_t obj)
+{
+	if (type_of(obj) == &TYPE_TABLE)
+		return (table_t)obj;
+	return NULL;
+}
+
+unsigned int hash_pointer(const void* ptr)
+{
+	uint64_t word = (uintptr_t)ptr * 0x9E3779B97F4A7C15ull;
+	return word >> 32;
+}
+
+unsigned int hash_key(object_t key)
+{
+	if (is_immediate(key))
+		return hash_pointer(key);
+
+	type_t type = type_of(key);
+	if (type == &TYPE_SYMBOL)
+		return ((symbol_t)key)->hash;
+	if (type == &TYPE_STRING) {
+		string_t str = (string_t)key;
+		return strhash(str->value, str->length);
+	}
+	DIE("Can't use %s as a hash table key", type->name);
+}
+
+bool same_key(object_t a, object_t b)
+{
+	if (a == b)
+		return true;
+	if (type_of(a) != &TYPE_STRING || type_of(b) != &TYPE_STRING)
+		return false;
+
+	string_t x = (string_t)a, y = (string_t)b;
+	return (x->length == y->length) &&
+	       (memcmp(x->value, y->value, x->length) == 0);
+}
+
+struct table_entry* find_in_slots(struct slots* slots,
+				  object_t key,
+				  unsigned int hash)
+{
+	if (slots->used == 0)
+		return NULL;
+
+	unsigned int mask = slots->size - 1;
+	for (unsigned int index = hash;; index++) {
+		struct table_entry* entry = &slots->data[index & mask];
+		if (! entry->key)
+			return NULL;
+		if (IS_ENTRY(entry) && entry->hash == hash &&
+		    same_key(entry->key, key))
+			return entry;
+	}
+}
+
+void put_in_slots(struct slots* slots, struct table_entry item)
+{
+	unsigned int mask = slots->size - 1;
+	for (unsigned int index = item.hash;; index++) {
+		struct table_entry* entry = &slots->data[index & mask];
+		if (! IS_ENTRY(entry)) {
+			if (! entry->key)
+				slots->filled++;
+			*entry = item;
+			slots->used++;
+			return;
+		}
+	}
+}
+
+void remove_from_slots(struct slots* slots, struct table_entry* entry)
+{
+	entry->key = &TOMBSTONE;
+	entry->value = NULL;
+	slots->used--;
+}
+
+void init_slots(struct slots* slots, unsigned int size)
+{
+	slots->data = calloc(size, sizeof(struct table_entry));
+	slots->size = size;
+	slots->used = 0;
+	slots->filled = 0;
+}
+
+void move_entries(table_t table, unsigned int count)
+{
+	struct slots* old = &table->old;
+	if (! old->data)
+		return;
+
+	for (; count > 0 && table->moved < old->size; count--) {
+		struct table_entry* entry = &old->data[table->moved++];
+		if (IS_ENTRY(entry)) {
+			put_in_slots(&table->live, *entry);
+			remove_from_slots(old, entry);
+		}
+	}
+
+	if (table->moved == old->size) {
+		free(old->data);
+		bzero(old, sizeof(*old));
+	}
+}
+
+void make_room_in_table(table_t table)
+{
+	struct slots* live = &table->live;
+	if ((live->filled + 1) * 2 <= live->size)
+		return;
+
+	move_entries(table, table->old.size);
+
+	unsigned int size = 8;
+	while (size < (live->used + 1) * 4)
+		size *= 2;
+
+	table->old = *live;
+	table->moved = 0;
+	init_slots(live, size);
+}
+
+struct table_entry* find_in_table(table_t table, object_t key)
+{
+	unsigned int hash = hash_key(key);
+	struct table_entry* entry = find_in_slots(&table->live, key, hash);
+	if (! entry)
+		entry = find_in_slots(&table->old, key, hash);
+	return entry;
+}
+
+//
+// The same slots, keyed by address, also make a set or a map by identity
+// for the C code that needs to remember which objects it has seen.
+//
+
+struct table_entry* find_by_identity(struct slots* slots, object_t key)
+{
+	return find_in_slots(slots, key, hash_pointer(key));
+}
+
+struct table_entry* add_by_identity(struct slots* slots, object_t key)
+{
+	if ((slots->filled + 1) * 2 > slots->size) {
+		struct slots old = *slots;
+		unsigned int size = 64;
+		while (size < (old.used + 1) * 4)
+			size *= 2;
+		init_slots(slots, size);
+		for (unsigned int i = 0; i < old.size; i++)
+			if (IS_ENTRY(&old.data[i]))
+				put_in_slots(slots, old.data[i]);
+		free(old.data);
+	}
+
+	struct table_entry item = {.key = key, .hash = hash_pointer(key)};
+	put_in_slots(slots, item);
+	return find_by_identity(slots, key);
+}
+
+object_t scan_string(source_t src)
+{
+	const char* start = src->pos;
+	int len = 0;
+
+	for (;; len++) {
+		if (src->pos >= src->end)
+			DIE("Premature end of input");
+		char ch = *(src->pos++);
+		if (ch == '\"')
+			break;
+		if (ch == '\\' && src->pos++ >= src->end)
+			DIE("Premature end of input");
+	}
+
+	char* value = malloc(len + 1);
+	for (int i = 0; i < len; i++) {
+		char ch = *(start++);
+		if (ch == '\\') {
+			ch = *(start++);
+			if (ch == 'n')
+				ch = '\n';
+		}
+		value[i] = ch;
+	}
+	value[len] = '\0';
+	return wrap_owned_string(value, len);
+}
+
+object_t scan_atom(source_t src)
+{
+	const char* start = src->pos;
+	while ((src->pos < src->end) && ! isspace(*src->pos) &&
+	       ! isspecial(*src->pos))
+		src->pos++;
+
+	int len = src->pos - start;
+	if (is_token("#\\", start, len)) {
+		if (src->pos == src->end)
+			return wrap_char(' ');
+		char ch = *(src->pos++);
+		return wrap_char(isspace(ch) ? ' ' : ch);
+	}
+	return parse_atom(start, len);
+}
+
+object_t scan_object(source_t src)
+{
+	int ch = skip_source(src);
+	if (ch == EOF)
+		return NULL;
+
+	switch (ch) {
+	case '(':
+		src->pos++;
+		return scan_list(src);
+	case ')':
+		DIE("Unmatched ')'");
+	case '\'':
+		src->pos++;
+		return scan_quote(src);
+	case '"':
+		src->pos++;
+		return scan_string(src);
+	default:
+		return scan_atom(src);
+	}
+}
+
+void execute_source(source_t src)
+{
+	object_t expr;
+	int frame = open_frame();
+
+	while ((expr = scan_object(src))) {
+		eval_repl(expr);
+		close_frame(frame);
+		compact_if_due();
+	}
+}
+
+bool execute_mapped(const char* filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || ! S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return true;
+	}
+
+	char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	struct source src = {.pos = data, .end = data + st.st_size};
+	execute_source(&src);
+	munmap(data, st.st_size);
+	return true;
+}
+
+#define IMAGE_MAGIC "scheme image 2\n"
+
+const char* unwrap_string(string_t);
+
+struct image {
+	FILE* out;
+	struct source src;
+	struct array lambdas;
+	struct slots seen;
+	object_t failed;
+};
+
+typedef struct image* image_t;
+
+//
+// A lambda that has been dumped already is written as its position in
+// `lambdas`. Going over that list for every object would make saving
+// quadratic, so `seen` maps each lambda to its position as well.
+//
+
+void remember_lambda(image_t image, lambda_t lambda)
+{
+	struct table_entry* entry =
+		add_by_identity(&image->seen, (object_t)lambda);
+	entry->value = wrap_int(image->lambdas.size);
+	push_to_array(&image->lambdas, (object_t)lambda);
+}
+
+int dumped_index(image_t image, object_t obj)
+{
+	struct table_entry* entry = find_by_identity(&image->seen, obj);
+	int index;
+	if (entry && unbox_int(&index, entry->value))
+		return index;
+	return -1;
+}
+
+void forget_lambdas(image_t image, int count)
+{
+	array_t lambdas = &image->lambdas;
+	struct slots* seen = &image->seen;
+	for (int i = count; i < lambdas->size; i++) {
+		object_t lambda = lambdas->data[i];
+		remove_from_slots(seen, find_by_identity(seen, lambda));
+	}
+	lambdas->size = count;
+}
+
+void dispose_image(image_t image)
+{
+	dispose_array(&image->lambdas);
+	free(image->seen.data);
+}
+
+void dump_word(image_t image, uint32_t word)
+{
+	fwrite(&word, sizeof(word), 1, image->out);
+}
+
+void dump_text(image_t image, char tag, const char* text)
+{
+	uint32_t len = strlen(text);
+	fputc(tag, image->out);
+	dump_word(image, len);
+	fwrite(text, 1, len, image->out);
+}
+
+void dump_object(image_t image, object_t obj);
+
+void dump_list(image_t image, array_t items, object_t tail)
+{
+	fputc('l', image->out);
+	dump_word(image, items->size);
+	for (int i = 0; i < items->size; i++)
+		dump_object(image, items->data[i]);
+	dump_object(image, tail);
+}
+
+void dump_pairs(image_t image, object_t list)
+{
+	struct array items;
+	init_array(&items);
+
+	pair_t pair;
+	while ((pair = to_pair(list))) {
+		push_to_array(&items, car(pair));
+		list = cdr(pair);
+	}
+
+	dump_list(image, &items, list);
+	dispose_array(&items);
+}
+
+void dump_code(image_t image, lambda_t lambda)
+{
+	if (lambda->template) {
+		dump_object(image, lambda->template->params);
+		dump_object(image, lambda->template->body);
+	} else {
+		object_t rest = (object_t)lambda->rest;
+		dump_list(image, &lambda->params, rest ? rest : wrap_nil());
+		dump_object(image, lambda->body);
+	}
+}
+
+void dump_scope(image_t image, scope_t scope)
+{
+	int count = 0;
+	if (type_of((object_t)scope) == &TYPE_FRAME) {
+		array_t names = &scope->template->names;
+		for (int i = 0; i < names->size; i++)
+			count += scope->slots[i] != NULL;
+		dump_word(image, count);
+		for (int i = 0; i < names->size; i++) {
+			if (scope->slots[i]) {
+				dump_object(image, names->data[i]);
+				dump_object(image, scope->slots[i]);
+			}
+		}
+		return;
+	}
+
+	dict_t binds = &scope->binds;
+	for (int i = 0; i < binds->size; i++)
+		count += binds->data[i].key != NULL;
+	dump_word(image, count);
+	for (int i = 0; i < binds->size; i++) {
+		dict_entry_t entry = &binds->data[i];
+		if (entry->key) {
+			dump_object(image, (object_t)entry->key);
+			dump_object(image, entry->value);
+		}
+	}
+}
+
+//
+// A closure over local variables takes its scopes along, outermost first,
+// and gets rebuilt on top of whatever the REPL scope is where it's loaded.
+// The lambda is recorded before the scopes so that a local function that
+// refers to itself comes back as a backreference.
+//
+
+void dump_closure(image_t image, lambda_t lambda)
+{
+	struct array chain;
+	init_array(&chain);
+	scope_t scope = lambda->scope;
+	for (; scope && scope != get_repl_scope(); scope = scope->parent)
+		push_to_array(&chain, (object_t)scope);
+
+	fputc('c', image->out);
+	dump_word(image, chain.size);
+	dump_code(image, lambda);
+	remember_lambda(image, lambda);
+
+	for (int i = chain.size - 1; i >= 0; i--)
+		dump_scope(image, (scope_t)chain.data[i]);
+	dispose_array(&chain);
+}
+
+void dump_lambda(image_t image, lambda_t lambda)
+{
+	if (lambda->scope != get_repl_scope()) {
+		dump_closure(image, lambda);
+		return;
+	}
+
+	fputc('f', image->out);
+	dump_code(image, lambda);
+	remember_lambda(image, lambda);
+}
+
+void dump_object(image_t image, object_t obj)
+{
+	type_t type = type_of(obj);
+	int index;
+
+	if (image->failed)
+		return;
+
+	if (is_immediate(obj)) {
+		fputc('i', image->out);
+		fwrite(&obj, sizeof(obj), 1, image->out);
+	} else if (type == &TYPE_SYMBOL) {
+		dump_text(image, 's', unwrap_symbol((symbol_t)obj));
+	} else if (type == &TYPE_STRING) {
+		dump_text(image, 'S', unwrap_string((string_t)obj));
+	} else if (type == &TYPE_PAIR) {
+		dump_pairs(image, obj);
+	} else if (type == &TYPE_VECTOR) {
+		array_t items = &((vector_t)obj)->items;
+		fputc('v', image->out);
+		dump_word(image, items->size);
+		for (int i = 0; i < items->size; i++)
+			dump_object(image, items->data[i]);
+	} else if (type == &TYPE_NATIVE) {
+		dump_text(image, 'b', ((native_t)obj)->name);
+	} else if (type == &TYPE_SYNTAX) {
+		dump_text(image, 'b', ((syntax_t)obj)->name);
+	} else if ((index = dumped_index(image, obj)) >= 0) {
+		fputc('F', image->out);
+		dump_word(image, index);
+	} else if (type == &TYPE_LAMBDA) {
+		dump_lambda(image, (lambda_t)obj);
+	} else {
+		image->failed = obj;
+	}
+}
+
+//
+// Dumping doesn't die on something it can't handle, but remembers it, so
+// that callers can skip that value or complain in their own words.
+//
+
+bool dump_binding(image_t image, symbol_t key, object_t value)
+{
+	long start = ftell(image->out);
+	int lambdas = image->lambdas.size;
+
+	dump_object(image, (object_t)key);
+	dump_object(image, value);
+	if (! image->failed)
+		return true;
+
+	fseek(image->out, start, SEEK_SET);
+	forget_lambdas(image, lambdas);
+	return false;
+}
+
+void save_image(const char* filename)
+{
+	struct image image = {.out = fopen_or_die(filename, "wb")};
+	init_array(&image.lambdas);
+
+	fputs(IMAGE_MAGIC, image.out);
+
+	dict_t binds = &get_repl_scope()->binds;
+	for (int i = 0; i < binds->size; i++) {
+		dict_entry_t entry = &binds->data[i];
+		if (! entry->key)
+			continue;
+		if (! dump_binding(&image, entry->key, entry->value))
+			DIE("Can't put %s into an image",
+			    typename(image.failed));
+	}
+
+	if (ferror(image.out) || fclose(image.out))
+		DIE("Error writing image %s: %s", filename, strerror(errno));
+	dispose_image(&image);
+}
+
+//
+
+const char* take_from_image(image_t image, int len)
+{
+	if (image->src.end - image->src.pos < len)
+		DIE("Truncated image");
+	const char* result = image->src.pos;
+	image->src.pos += len;
+	return result;
+}
+
+uint32_t load_word(image_t image)
+{
+	uint32_t word;
+	memcpy(&word, take_from_image(image, sizeof(word)), sizeof(word));
+	return word;
+}
+
+object_t load_object(image_t image);
+
+object_t load_list(image_t image)
+{
+	struct array items;
+	init_array(&items);
+
+	for (uint32_t count = load_word(image); count > 0; count--)
+		push_to_array(&items, load_object(image));
+
+	object_t result = load_object(image);
+	while (items.size) {
+		object_t item = pop_from_array(&items);
+		push_to_list(&result, item);
+	}
+
+	dispose_array(&items);
+	return result;
+}
+
+object_t load_vector(image_t image)
+{
+	vector_t vector = wrap_vector(0, NULL);
+	for (uint32_t count = load_word(image); count > 0; count--) {
+		object_t item = load_object(image);
+		write_barrier((object_t)vector, NULL, item);
+		push_to_array(&vector->items, item);
+	}
+	return (object_t)vector;
+}
+
+object_t load_lambda(image_t image)
+{
+	object_t params = load_object(image);
+	object_t body = load_object(image);
+
+	object_t result = wrap_lambda(get_repl_scope(), params, body);
+	push_to_array(&image->lambdas, result);
+
+	return result;
+}
+
+void load_scope_entry(image_t image, scope_t scope)
+{
+	symbol_t key = to_symbol(load_object(image));
+	if (! key)
+		DIE("Corrupt image");
+	object_t value = load_object(image);
+	define(scope, key, value);
+}
+
+void load_scope(image_t image, scope_t scope)
+{
+	for (uint32_t count = load_word(image); count > 0; count--)
+		load_scope_entry(image, scope);
+}
+
+object_t load_closure(image_t image)
+{
+	uint32_t depth = load_word(image);
+	object_t params = load_object(image);
+	object_t body = load_object(image);
+
+	struct array chain;
+	init_array(&chain);
+	scope_t scope = get_repl_scope();
+	for (uint32_t i = 0; i < depth; i++) {
+		scope = derive_scope(scope);
+		push_to_array(&chain, (object_t)scope);
+	}
+
+	object_t result = wrap_lambda(scope, params, body);
+	push_to_array(&image->lambdas, result);
+
+	for (int i = 0; i < chain.size; i++)
+		load_scope(image, (scope_t)chain.data[i]);
+	dispose_array(&chain);
+	return result;
+}
+
+object_t load_builtin(image_t image)
+{
+	uint32_t len = load_word(image);
+	const char* name = take_from_image(image, len);
+	symbol_t key = (symbol_t)intern_symbol(name, len);
+	object_t obj = lookup_in_dict(&BUILTINS, key);
+	if (! obj)
+		DIE("Image refers to unknown builtin %s", unwrap_symbol(key));
+	return obj;
+}
+
+object_t load_backreference(image_t image)
+{
+	uint32_t index = load_word(image);
+	if (index >= image->lambdas.size)
+		DIE("Bad reference in image");
+	return image->lambdas.data[index];
+}
+
+object_t load_object(image_t image)
+{
+	object_t obj;
+	uint32_t len;
+
+	switch (*take_from_image(image, 1)) {
+	case 'i':
+		memcpy(&obj, take_from_image(image, sizeof(obj)), sizeof(obj));
+		return obj;
+	case 's':
+		len = load_word(image);
+		return intern_symbol(take_from_image(image, len), len);
+	case 'S':
+		len = load_word(image);
+		return wrap_owned_string(
+			strndup(take_from_image(image, len), len), len);
+	case 'l':
+		return load_list(image);
+	case 'v':
+		return load_vector(image);
+	case 'f':
+		return load_lambda(image);
+	case 'c':
+		return load_closure(image);
+	case 'b':
+		return load_builtin(image);
+	case 'F':
+		return load_backreference(image);
+	default:
+		DIE("Corrupt image");
+	}
+}
+
+void load_image(const char* filename)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if ((fd < 0) || (fstat(fd, &st) != 0))
+		DIE("Error opening image %s: %s", filename, strerror(errno));
+
+	// A file too short for the magic is not an image, not a truncated one
+	int magic = strlen(IMAGE_MAGIC);
+	if (st.st_size < magic)
+		DIE("%s is not an image", filename);
+
+	char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		DIE("Error mapping image %s: %s", filename, strerror(errno));
+
+	struct image image = {.src = {.pos = data, .end = data + st.st_size}};
+	init_array(&image.lambdas);
+
+	if (memcmp(take_from_image(&image, magic), IMAGE_MAGIC, magic) != 0)
+		DIE("%s is not an image", filename);
+
+	scope_t repl = get_repl_scope();
+	int frame = open_frame();
+	while (image.src.pos < image.src.end) {
+		close_frame(frame);
+		symbol_t key = to_symbol(load_object(&image));
+		if (! key)
+			DIE("Corrupt image");
+		object_t value = load_object(&image);
+
+		object_t existing = lookup_in_dict(&repl->binds, key);
+		if (! existing)
+			define(repl, key, value);
+		else if (existing != value)
+			DIE("Image redefines %s", unwrap_symbol(key));
+	}
+	close_frame(frame);
+
+	dispose_image(&image);
+	munmap(data, st.st_size);
+}
+
+void read_stdlib(void)
+{
+	if (IMAGE_PATH)
+		load_image(IMAGE_PATH);
+	else
+		execute_file("stdlib.scm");
+}
+
+void load_stdlib()
+{
+	read_stdlib();
+	if (SAVE_IMAGE_PATH)
+		save_image(SAVE_IMAGE_PATH);
+}
+
+//
+// Remember how, back in the first chapter, I said I consciously didn't
+// care about having more than one runtime? Well, it turns out that all it
+// takes is `_Thread_local` in front of every global, and then a thread
+// that calls `setup_runtime()` has an interpreter all to itself. That's
+// what `--jobs=N` does: it starts N threads that take the files off a
+// shared queue one by one and run each in a brand new runtime.
+//
+// Their output can't just go to `stdout`, though, or it would come out
+// interleaved. So every job writes to a memory stream, and once they're
+// all done, the results are printed in the order the files were given.
+//
+// A job that dies keeps whatever it printed up to that point, and the
+// other jobs carry on. Its runtime still gets torn down, minus the scopes
+// that were on the C stack, which went away with the frames that held
+// them. The handles those frames had are simply dropped, so whatever they
+// held gets collected with the rest. Once everything has been printed,
+// the runner dies itself if any job did.
+//
+
+#include <sys/resource.h>
+
+_Thread_local FILE* OUTPUT = NULL;
+
+FILE* current_output(void)
+{
+	return OUTPUT ? OUTPUT : stdout;
+}
+
+// Evaluation recurses, so give workers as much stack as main has
+void init_worker_attr(pthread_attr_t* attr)
+{
+	pthread_attr_init(attr);
+	struct rlimit limit;
+	if ((getrlimit(RLIMIT_STACK, &limit) == 0) &&
+	    (limit.rlim_cur != RLIM_INFINITY))
+		pthread_attr_setstacksize(attr, limit.rlim_cur);
+}
+
+struct job {
+	const char* file;
+	char* output;
+	size_t length;
+	bool failed;
+};
+
+struct job_queue {
+	pthread_mutex_t lock;
+	struct job* jobs;
+	int count;
+	int next;
+	long gc_pause;
+};
+
+void run_job(struct job* job, long gc_pause)
+{
+	setup_runtime();
+	if (gc_pause)
+		enable_incremental_gc(gc_pause);
+	OUTPUT = open_memstream(&job->output, &job->length);
+	ASSERT(OUTPUT, "Can't capture output: %s", strerror(errno));
+
+	jmp_buf recovery;
+	if (setjmp(recovery) == 0) {
+		DIE_RECOVERY = &recovery;
+		read_stdlib();
+		execute_file(job->file);
+	} else {
+		job->failed = true;
+		STACK_SCOPES.size = 0;
+	}
+	DIE_RECOVERY = NULL;
+	teardown_runtime();
+
+	fclose(OUTPUT);
+	OUTPUT = NULL;
+}
+
+void* job_worker(void* arg)
+{
+	struct job_queue* queue = arg;
+	ROLE = JOB_THREAD;
+
+	while (true) {
+		pthread_mutex_lock(&queue->lock);
+		int index = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (index >= queue->count)
+			return NULL;
+		run_job(&queue->jobs[index], queue->gc_pause);
+	}
+}
+
+void run_jobs(int count, const char** files)
+{
+	struct job_queue queue = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.jobs = calloc(count, sizeof(struct job)),
+		.count = count,
+		.gc_pause = GC_MODE == GC_INCREMENTAL ? GC_PAUSE_USEC : 0,
+	};
+	for (int i = 0; i < count; i++)
+		queue.jobs[i].file = files[i];
+
+	pthread_attr_t attr;
+	init_worker_attr(&attr);
+
+	int threads = JOBS < count ? JOBS : count;
+	pthread_t* workers = malloc(threads * sizeof(pthread_t));
+	for (int i = 0; i < threads; i++) {
+		int error =
+			pthread_create(&workers[i], &attr, job_worker, &queue);
+		if (error)
+			DIE("Can't start a worker: %s", strerror(error));
+	}
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+	pthread_attr_destroy(&attr);
+
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		fwrite(queue.jobs[i].output, 1, queue.jobs[i].length, stdout);
+		free(queue.jobs[i].output);
+		failed += queue.jobs[i].failed;
+	}
+	free(workers);
+	free(queue.jobs);
+	if (failed)
+		DIE("%d of %d jobs failed", failed, count);
+}
+
+//
+// Loading the library is most of what a short script costs, and a job
+// runner that starts `./scheme foo.scm` for every file pays for it every
+// single time. `--serve=PATH` pays once: it loads the library, collects
+// whatever that left behind, and then forks for every connection on a Unix
+// socket. Each fork is a copy of a runtime that's ready to go, and since
+// it's a process of its own, a script that dies (and `DIE` does mean die)
+// or redefines half the library only takes its own copy with it. So there
+// is nothing to reset between requests: the next one forks from the same
+// clean heap again.
+//
+// The client sends the file names along with its own standard streams and
+// working directory, so the script reads and writes exactly where it would
+// if it had been run directly, and its output goes straight to the
+// client's terminal or pipe rather than through the socket. The socket
+// only carries the exit status back, and the client exits with it. Any
+// options, `--vm` or `--gc-stats` say, are the ones the server was started
+// with, since that's the runtime the script gets.
+//
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// stdin, stdout, stderr and the working directory
+#define PASSED_FDS 4
+
+struct sockaddr_un socket_address(const char* path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path))
+		DIE("Socket path is too long: %s", path);
+	strcpy(addr.sun_path, path);
+	return addr;
+}
+
+// Descriptors need at least a byte to travel with, so the request starts
+// with a NUL, followed by file names, each terminated by a NUL as well
+void send_to_server(const char* path, int count, const char** files)
+{
+	struct sockaddr_un addr = socket_address(path);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((sock < 0) || connect(sock, (struct sockaddr*)&addr, sizeof(addr)))
+		DIE("Can't connect to %s: %s", path, strerror(errno));
+
+	int fds[PASSED_FDS] = {0, 1, 2, open(".", O_RDONLY | O_DIRECTORY)};
+	if (fds[3] < 0)
+		DIE("Can't open the working directory: %s", strerror(errno));
+
+	union {
+		char data[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {.iov_base = "", .iov_len = 1};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.data,
+		.msg_controllen = sizeof(control.data),
+	};
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	signal(SIGPIPE, SIG_IGN);
+	bool sent = sendmsg(sock, &msg, 0) == 1;
+	for (int i = 0; sent && i < count; i++) {
+		size_t length = strlen(files[i]) + 1;
+		sent = write(sock, files[i], length) == (ssize_t)length;
+	}
+	if (! sent || shutdown(sock, SHUT_WR))
+		DIE("Can't send the request: %s", strerror(errno));
+
+	unsigned char status;
+	if (read(sock, &status, 1) != 1)
+		DIE("Server at %s dropped the request", path);
+	exit(status);
+}
+
+bool receive_request(int conn, int* fds, char** names, size_t* length)
+{
+	union {
+		char data[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char chunk[4096];
+	struct iovec iov = {.iov_base = chunk, .iov_len = sizeof(chunk)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.data,
+		.msg_controllen = sizeof(control.data),
+	};
+
+	ssize_t got = recvmsg(conn, &msg, 0);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if ((got <= 0) || ! cmsg || (cmsg->cmsg_type != SCM_RIGHTS) ||
+	    (cmsg->cmsg_len != CMSG_LEN(PASSED_FDS * sizeof(int))))
+		return false;
+	memcpy(fds, CMSG_DATA(cmsg), PASSED_FDS * sizeof(int));
+
+	FILE* out = open_memstream(names, length);
+	ASSERT(out, "Can't buffer the request: %s", strerror(errno));
+	do
+		fwrite(chunk, 1, got, out);
+	while ((got = read(conn, chunk, sizeof(chunk))) > 0);
+	fclose(out);
+
+	return (got == 0) && (*names)[*length - 1] == '\0';
+}
+
+// Runs in a fresh fork, and never comes back
+void run_request(int* fds, const char* names, size_t length)
+{
+	for (int i = 0; i < 3; i++)
+		dup2(fds[i], i);
+	if (fchdir(fds[3]) != 0)
+		DIE("Can't enter the client's directory: %s", strerror(errno));
+	for (int i = 0; i < PASSED_FDS; i++)
+		close(fds[i]);
+	if (isatty(fileno(stdout)))
+		setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (length > 1) {
+		size_t pos = 1;
+		for (; pos < length; pos += strlen(&names[pos]) + 1)
+			execute_file(&names[pos]);
+	} else if (isatty(fileno(stdin))) {
+		repl();
+	} else {
+		execute(stdin);
+	}
+
+	// Tearing down touches every page this fork still shares with the
+	// server, only for the process to drop them all right after
+	if (GC_REPORT || GC_SUMMARY || PROFILE_REPORT)
+		teardown_runtime();
+	exit(0);
+}
+
+// The script's process can die in all sorts of ways, so it gets a parent
+// of its own to watch it and report back
+int handle_connection(int conn)
+{
+	int fds[PASSED_FDS];
+	char* names = NULL;
+	size_t length = 0;
+	if (! receive_request(conn, fds, &names, &length))
+		return 1;
+
+	signal(SIGCHLD, SIG_DFL);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(conn);
+		run_request(fds, names, length);
+	}
+
+	int status;
+	unsigned char code = 1;
+	if ((pid > 0) && (waitpid(pid, &status, 0) == pid))
+		code = WIFEXITED(status) ? WEXITSTATUS(status)
+					 : 128 + WTERMSIG(status);
+	return write(conn, &code, 1) == 1 ? 0 : 1;
+}
+
+void serve(const char* path)
+{
+	struct sockaddr_un addr = socket_address(path);
+	struct stat st;
+	if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((sock < 0) || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) ||
+	    listen(sock, SOMAXCONN))
+		DIE("Can't listen on %s: %s", path, strerror(errno));
+
+	// Every request starts from this heap, so make it a tidy one
+	if (COMPACT) {
+		compact_heap();
+	} else {
+		finish_collection();
+		collect_nursery();
+		collect_garbage();
+	}
+	fflush(NULL);
+	signal(SIGCHLD, SIG_IGN);
+
+	while (true) {
+		int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			DIE("Can't accept a connection: %s", strerror(errno));
+		}
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(sock);
+			_exit(handle_connection(conn));
+		}
+		close(conn);
+	}
+}
+
+// CUTOFF
+
+bool unbox_int(int*, object_t);
+
+bool equal(object_t x, object_t y);
+
+object_t native_cons(int argct, object_t* args) // cons
+{
+	assert_arg_count("cons", argct, 2);
+	return wrap_pair(args[0], args[1]);
+}
+
+object_t native_eqp(int argct, object_t* args) // eq?
+{
+	assert_arg_count("eq?", argct, 2);
+	return wrap_bool(args[0] == args[1]);
+}
+
+object_t native_equalp(int argct, object_t* args) // equal?
+{
+	assert_arg_count("equal?", argct, 2);
+	return wrap_bool(equal(args[0], args[1]));
+}
+
+object_t native_list(int argct, object_t* args) // list
+{
+	return wrap_list(argct, args);
+}
+
+// The list is spread into an argument window after the other arguments,
+// however long it is, and a lambda is left to the trampoline, which keeps
+// `apply` in tail position a tail call
+object_t spread_call(object_t func, int argct, object_t* args, object_t list)
+{
+	int length = list_length(list);
+	if (length < 0)
+		DIE("Expected a list of arguments to apply");
+
+	int total = argct + length;
+	object_t* window = reserve_args(total), rest = list;
+	for (int i = 0; i < total; i++)
+		window[i] = i < argct ? args[i] : pop_from_list(&rest);
+
+	object_t result;
+	lambda_t lambda = to_lambda(func);
+	if (lambda) {
+		result = wrap_thunk(lambda, total, window);
+		PENDING_CALL.spread = length ? list : NULL;
+		PENDING_CALL.spread_at = argct;
+	} else {
+		result = invoke_lazily(func, total, window);
+	}
+	release_args(total);
+	return result;
+}
+
+object_t apply_to_list(object_t func, int argct, object_t* args, object_t list)
+{
+	return force(spread_call(func, argct, args, list));
+}
+
+object_t native_apply(int argct, object_t* args) // apply
+{
+	assert_vararg_count("apply", argct, 2, INT_MAX);
+	return spread_call(args[0], argct - 2, &args[1], args[argct - 1]);
+}
+
+object_t native_fold(int argct, object_t* args) // fold
+{
+	assert_arg_count("fold", argct, 3);
+
+	object_t func = args[0];
+	object_t seed = args[1];
+	object_t seq = args[2];
+
+	object_t result = seed, item;
+	int frame = open_frame();
+
+	// Only the latest result has to be kept, so every round starts over
+	while ((item = pop_from_list(&seq))) {
+		object_t args[] = {result, item};
+		result = close_frame_with(frame, invoke(func, 2, args));
+	}
+	return result;
+}
+
+struct list_builder {
+	object_t head;
+	pair_t tail;
+};
+
+void append_to_builder(struct list_builder* builder, object_t item)
+{
+	object_t cell = wrap_pair(item, wrap_nil());
+	pair_t tail = builder->tail;
+	if (tail) {
+		write_barrier((object_t)tail, tail->cdr, cell);
+		tail->cdr = cell;
+	} else {
+		builder->head = cell;
+	}
+	builder->tail = (pair_t)cell;
+}
+
+object_t finish_builder(struct list_builder* builder, object_t tail)
+{
+	if (! builder->tail)
+		return tail;
+	pair_t last = builder->tail;
+	write_barrier((object_t)last, last->cdr, tail);
+	last->cdr = tail;
+	return builder->head;
+}
+
+object_t native_map(int argct, object_t* args) // map
+{
+	assert_arg_count("map", argct, 2);
+	object_t func = args[0], seq = args[1], item;
+	struct list_builder builder = {NULL, NULL};
+
+	while ((item = pop_from_list(&seq)))
+		append_to_builder(&builder, invoke(func, 1, &item));
+	return finish_builder(&builder, wrap_nil());
+}
+
+object_t native_filter(int argct, object_t* args) // filter
+{
+	assert_arg_count("filter", argct, 2);
+	object_t func = args[0], seq = args[1], item;
+	struct list_builder builder = {NULL, NULL};
+
+	while ((item = pop_from_list(&seq)))
+		if (is_true(invoke(func, 1, &item)))
+			append_to_builder(&builder, item);
+	return finish_builder(&builder, wrap_nil());
+}
+
+object_t native_append(int argct, object_t* args) // append
+{
+	if (argct == 0)
+		return wrap_nil();
+
+	struct list_builder builder = {NULL, NULL};
+	for (int i = 0; i < argct - 1; i++) {
+		object_t seq = args[i], item;
+		while ((item = pop_from_list(&seq)))
+			append_to_builder(&builder, item);
+	}
+	return finish_builder(&builder, args[argct - 1]);
+}
+
+object_t native_length(int argct, object_t* args) // length
+{
+	assert_arg_count("length", argct, 1);
+	int length = list_length(args[0]);
+	if (length < 0)
+		DIE("Expected a list as an argument of length");
+	return wrap_int(length);
+}
+
+int unbox_int_or_die(const char*, object_t);
+
+object_t native_list_tail(int argct, object_t* args) // list-tail
+{
+	assert_arg_count("list-tail", argct, 2);
+	object_t seq = args[0];
+	int count = unbox_int_or_die("list-tail", args[1]);
+
+	for (; count > 0; count--)
+		seq = cdr(assert_pair(seq, "as argument #1 of list-tail"));
+	return seq;
+}
+
+//
+// Futures build on the same idea. A runtime can't share its heap with
+// another thread, so `(future thunk)` doesn't hand the thunk over, but a
+// copy of it, written in the image format. A pool of worker threads,
+// each with a runtime of its own, loads the copy, runs it and writes the
+// result back the same way, and `(touch future)` loads that result into
+// the runtime that asked for it.
+//
+// A thunk expects to see the globals, too, so the REPL scope gets copied
+// along, once per change of bindings. And it's a copy: changes made by a
+// future never make it back, except through its result. So futures are
+// meant for pure functions of copyable data, and they are held to that.
+// A call that refers to something that can't be copied, a port or a hash
+// table, say, whether as an argument, in a scope it closes over or as a
+// global, doesn't make it into the pool at all: `future` and `pmap` die
+// on the spot rather than leave the worker to trip over an undefined
+// variable.
+//
+// If nobody has picked the task up by the time a worker touches it, the
+// worker runs it right away, on a copy of its own. That way a future that
+// waits for futures of its own never waits for a worker that is busy
+// waiting for it, and the task sees exactly what it would have seen on
+// any other worker. Whoever else touches a future just waits. That's as
+// far as stealing goes, though: the pool is a single queue, and a worker
+// that runs out of work simply takes the oldest task off it.
+//
+
+enum task_state {
+	TASK_QUEUED,
+	TASK_RUNNING,
+	TASK_DONE,
+	TASK_CLAIMED,
+};
+
+struct snapshot {
+	unsigned long id;
+	int refs;
+	char* data;
+	size_t size;
+};
+
+struct task {
+	struct task* next;
+	enum task_state state;
+	int refs;
+	bool map;
+	struct snapshot* globals;
+	char* call;
+	size_t call_size;
+	char* result;
+	size_t result_size;
+};
+
+struct future_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	pthread_cond_t done;
+	struct task* head;
+	struct task* tail;
+	pthread_t* workers;
+	int count;
+	bool stopping;
+	unsigned long snapshots;
+} POOL = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.queued = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+_Thread_local struct snapshot* GLOBALS = NULL;
+_Thread_local unsigned GLOBALS_VERSION;
+_Thread_local unsigned GLOBALS_SETS;
+
+// The globals that were left out of `GLOBALS`, and the templates that were
+// already checked against them
+_Thread_local struct dict UNCOPIED;
+_Thread_local struct slots VETTED;
+
+// These two expect the pool lock to be held
+
+void release_snapshot(struct snapshot* snapshot)
+{
+	if (--snapshot->refs == 0) {
+		free(snapshot->data);
+		free(snapshot);
+	}
+}
+
+void release_task(struct task* task)
+{
+	if (--task->refs == 0) {
+		release_snapshot(task->globals);
+		free(task->call);
+		free(task->result);
+		free(task);
+	}
+}
+
+void release_globals(void)
+{
+	if (! GLOBALS)
+		return;
+	pthread_mutex_lock(&POOL.lock);
+	release_snapshot(GLOBALS);
+	pthread_mutex_unlock(&POOL.lock);
+	GLOBALS = NULL;
+
+	dispose_dict(&UNCOPIED);
+	for (unsigned int i = 0; i < VETTED.size; i++)
+		if (IS_ENTRY(&VETTED.data[i]))
+			unpin(VETTED.data[i].key);
+	free(VETTED.data);
+	bzero(&VETTED, sizeof(VETTED));
+}
+
+struct snapshot* snapshot_globals(void)
+{
+	if (GLOBALS && (GLOBALS_VERSION == BINDINGS_VERSION) &&
+	    (GLOBALS_SETS == GLOBAL_SETS))
+		return GLOBALS;
+	release_globals();
+
+	struct snapshot* snapshot = calloc(1, sizeof(*snapshot));
+	struct image image = {
+		.out = open_memstream(&snapshot->data, &snapshot->size),
+	};
+	init_array(&image.lambdas);
+
+	dict_t binds = &get_repl_scope()->binds;
+	for (int i = 0; i < binds->size; i++) {
+		dict_entry_t entry = &binds->data[i];
+		if (! entry->key)
+			continue;
+		if (! dump_binding(&image, entry->key, entry->value)) {
+			put_in_dict(&UNCOPIED, entry->key, image.failed);
+			image.failed = NULL;
+		}
+	}
+	fclose(image.out);
+	dispose_image(&image);
+
+	pthread_mutex_lock(&POOL.lock);
+	snapshot->id = ++POOL.snapshots;
+	snapshot->refs = 1;
+	pthread_mutex_unlock(&POOL.lock);
+
+	GLOBALS = snapshot;
+	GLOBALS_VERSION = BINDINGS_VERSION;
+	GLOBALS_SETS = GLOBAL_SETS;
+	return snapshot;
+}
+
+void load_globals(struct snapshot* snapshot)
+{
+	struct image image = {
+		.src = {snapshot->data, snapshot->data + snapshot->size},
+	};
+	init_array(&image.lambdas);
+	int frame = open_frame();
+	while (image.src.pos < image.src.end) {
+		load_scope_entry(&image, get_repl_scope());
+		close_frame(frame);
+	}
+	dispose_image(&image);
+}
+
+void dump_to_memory(object_t obj, char** data, size_t* size, const char* what)
+{
+	struct image image = {.out = open_memstream(data, size)};
+	init_array(&image.lambdas);
+	dump_object(&image, obj);
+	fclose(image.out);
+	dispose_image(&image);
+
+	if (image.failed)
+		DIE("Can't %s %s", what, typename(image.failed));
+}
+
+object_t load_from_memory(const char* data, size_t size)
+{
+	struct image image = {.src = {data, data + size}};
+	init_array(&image.lambdas);
+	object_t result = load_object(&image);
+	dispose_image(&image);
+	return result;
+}
+
+//
+// Before a call goes out, `vet_call()` goes over everything it can reach:
+// its arguments, the code of its lambdas, the scopes they close over, and
+// the code of every global function that code refers to. Analysed code
+// refers to globals through `struct global`, so those are easy to tell
+// apart from locals; the rare lambda that couldn't be analysed only has
+// its source, and there every symbol counts. A template that passed needs
+// no second look until the next snapshot, so `VETTED` holds on to it.
+//
+
+void vet_global(array_t work, symbol_t name)
+{
+	object_t missing = lookup_in_dict(&UNCOPIED, name);
+	if (missing)
+		DIE("A future can't use %s: a %s can't be copied",
+		    unwrap_symbol(name),
+		    typename(missing));
+
+	object_t value = lookup_in_dict(&get_repl_scope()->binds, name);
+	if (value && type_of(value) == &TYPE_LAMBDA)
+		push_to_array(work, value);
+}
+
+void vet_source(array_t work, object_t code)
+{
+	pair_t pair;
+	for (; (pair = to_pair(code)); code = cdr(pair))
+		vet_source(work, car(pair));
+	if (type_of(code) == &TYPE_SYMBOL)
+		vet_global(work, (symbol_t)code);
+}
+
+void vet_scopes(array_t work, struct slots* seen, lambda_t lambda)
+{
+	scope_t scope = lambda->scope;
+	for (; scope && scope != get_repl_scope(); scope = scope->parent) {
+		if (find_by_identity(seen, (object_t)scope))
+			return;
+		add_by_identity(seen, (object_t)scope);
+
+		if (type_of((object_t)scope) == &TYPE_FRAME) {
+			int count = scope->template->names.size;
+			for (int i = 0; i < count; i++)
+				if (scope->slots[i])
+					push_to_array(work, scope->slots[i]);
+			continue;
+		}
+		dict_t binds = &scope->binds;
+		for (int i = 0; i < binds->size; i++)
+			if (binds->data[i].key)
+				push_to_array(work, binds->data[i].value);
+	}
+}
+
+void vet_item(array_t work, struct slots* seen, object_t obj)
+{
+	type_t type = type_of(obj);
+	if (type == &TYPE_PAIR) {
+		push_to_array(work, cdr((pair_t)obj));
+		push_to_array(work, car((pair_t)obj));
+	} else if (type == &TYPE_VECTOR) {
+		array_t items = &((vector_t)obj)->items;
+		for (int i = 0; i < items->size; i++)
+			push_to_array(work, items->data[i]);
+	} else if (type == &TYPE_GLOBAL) {
+		vet_global(work, ((global_t)obj)->name);
+	} else if (type == &TYPE_TEMPLATE) {
+		if (find_by_identity(&VETTED, obj))
+			return;
+		add_by_identity(&VETTED, obj);
+		pin(obj);
+
+		template_t template = (template_t)obj;
+		push_to_array(work, template->code);
+		for (int i = 0; i < template->constants.size; i++)
+			push_to_array(work, template->constants.data[i]);
+	} else if (type == &TYPE_LAMBDA) {
+		lambda_t lambda = (lambda_t)obj;
+		if (find_by_identity(seen, obj))
+			return;
+		add_by_identity(seen, obj);
+
+		if (lambda->template)
+			push_to_array(work, (object_t)lambda->template);
+		else
+			vet_source(work, lambda->body);
+		vet_scopes(work, seen, lambda);
+	}
+}
+
+void vet_call(object_t call)
+{
+	struct slots seen = {0};
+	struct array work;
+	init_array(&work);
+
+	push_to_array(&work, call);
+	while (work.size)
+		vet_item(&work, &seen, pop_from_array(&work));
+
+	dispose_array(&work);
+	free(seen.data);
+}
+
+//
+// A task is a function and a list of arguments. A future calls the
+// function with those arguments, while `pmap` hands over a whole chunk of
+// its list and the function gets called on each item in turn.
+//
+
+object_t run_call(object_t func, object_t items, bool map)
+{
+	if (! map)
+		return apply_to_list(func, 0, NULL, items);
+
+	struct list_builder builder = {NULL, NULL};
+	object_t item;
+	while ((item = pop_from_list(&items)))
+		append_to_builder(&builder, invoke(func, 1, &item));
+	return finish_builder(&builder, wrap_nil());
+}
+
+object_t run_copy(struct task* task)
+{
+	object_t call = load_from_memory(task->call, task->call_size);
+	pair_t pair = to_pair(call);
+	ASSERT(pair, "Corrupt task");
+
+	return run_call(car(pair), cdr(pair), task->map);
+}
+
+void run_task(struct task* task)
+{
+	int frame = open_frame();
+	object_t result = run_copy(task);
+	dump_to_memory(result,
+		       &task->result,
+		       &task->result_size,
+		       "return from a future a");
+	close_frame(frame);
+}
+
+struct task* next_task(void)
+{
+	while (! POOL.stopping) {
+		struct task* task = POOL.head;
+		if (! task) {
+			pthread_cond_wait(&POOL.queued, &POOL.lock);
+			continue;
+		}
+
+		POOL.head = task->next;
+		if (! POOL.head)
+			POOL.tail = NULL;
+		if (task->state == TASK_QUEUED)
+			return task;
+		release_task(task);
+	}
+	return NULL;
+}
+
+void* future_worker(void* arg)
+{
+	ROLE = POOL_THREAD;
+	setup_runtime();
+	unsigned long loaded = 0;
+
+	pthread_mutex_lock(&POOL.lock);
+	struct task* task;
+	while ((task = next_task())) {
+		task->state = TASK_RUNNING;
+		pthread_mutex_unlock(&POOL.lock);
+
+		if (task->globals->id != loaded) {
+			load_globals(task->globals);
+			loaded = task->globals->id;
+		}
+		run_task(task);
+
+		pthread_mutex_lock(&POOL.lock);
+		task->state = TASK_DONE;
+		pthread_cond_broadcast(&POOL.done);
+		release_task(task);
+	}
+	pthread_mutex_unlock(&POOL.lock);
+
+	teardown_runtime();
+	return NULL;
+}
+
+void start_future_pool(void)
 {
-	assert_arg_count("fold", argct, 3);
+	pthread_mutex_lock(&POOL.lock);
+	if (POOL.workers) {
+		pthread_mutex_unlock(&POOL.lock);
+		return;
+	}
 
-	object_t func = args[0];
-	object_t seed = args[1];
-	object_t seq = args[2];
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	POOL.count = JOBS > 1 ? JOBS : cores > 1 ? cores : 1;
+	POOL.workers = malloc(POOL.count * sizeof(pthread_t));
+
+	pthread_attr_t attr;
+	init_worker_attr(&attr);
+	for (int i = 0; i < POOL.count; i++) {
+		int error = pthread_create(
+			&POOL.workers[i], &attr, future_worker, NULL);
+		if (error)
+			DIE("Can't start a worker: %s", strerror(error));
+	}
+	pthread_attr_destroy(&attr);
+	pthread_mutex_unlock(&POOL.lock);
+}
 
-	object_t result = seed;
-	incref(result);
+void stop_future_pool(void)
+{
+	if (! POOL.workers)
+		return;
 
-	object_t item;
+	pthread_mutex_lock(&POOL.lock);
+	POOL.stopping = true;
+	pthread_cond_broadcast(&POOL.queued);
+	pthread_mutex_unlock(&POOL.lock);
 
-	while ((item = pop_from_list(&seq))) {
-		object_t args[] = {result, item};
-		incref(item);
-		result = invoke(func, 2, args);
+	for (int i = 0; i < POOL.count; i++)
+		pthread_join(POOL.workers[i], NULL);
+
+	pthread_mutex_lock(&POOL.lock);
+	while (POOL.head) {
+		struct task* task = POOL.head;
+		POOL.head = task->next;
+		release_task(task);
 	}
-	return result;
+	POOL.tail = NULL;
+	pthread_mutex_unlock(&POOL.lock);
+
+	free(POOL.workers);
+	POOL.workers = NULL;
+	POOL.stopping = false;
 }
 
-int unbox_int_or_die(const char*, object_t);
+//
+// On the side of the runtime that makes them, futures are objects like
+// any other. They hold on to the task until it's touched, and to its value
+// after that.
+//
+
+struct future {
+	struct object self;
+	object_t value;
+	struct task* task;
+};
+
+typedef struct future* future_t;
+
+void reach_future(object_t obj)
+{
+	future_t future = (future_t)obj;
+	reach_field(&future->value);
+}
+
+void dispose_future(object_t obj)
+{
+	future_t future = (future_t)obj;
+	if (! future->task)
+		return;
+
+	pthread_mutex_lock(&POOL.lock);
+	if (future->task->state == TASK_QUEUED)
+		future->task->state = TASK_CLAIMED;
+	release_task(future->task);
+	pthread_mutex_unlock(&POOL.lock);
+}
+
+struct type TYPE_FUTURE = {
+	.name = "future",
+	.dispose = dispose_future,
+	.reach = reach_future,
+};
+
+future_t to_future(object_t obj)
+{
+	if (type_of(obj) == &TYPE_FUTURE)
+		return (future_t)obj;
+	return NULL;
+}
+
+object_t spawn_task(object_t func, object_t args, bool map)
+{
+	start_future_pool();
+
+	struct snapshot* globals = snapshot_globals();
+	struct task* task = calloc(1, sizeof(*task));
+	task->refs = 2;
+	task->map = map;
+	object_t call = wrap_pair(func, args);
+	vet_call(call);
+	dump_to_memory(
+		call, &task->call, &task->call_size, "pass to a future a");
+
+	future_t future = alloc_object(&TYPE_FUTURE, sizeof(*future));
+	future->value = NULL;
+	future->task = task;
+
+	pthread_mutex_lock(&POOL.lock);
+	globals->refs++;
+	task->globals = globals;
+	if (POOL.tail)
+		POOL.tail->next = task;
+	else
+		POOL.head = task;
+	POOL.tail = task;
+	pthread_cond_signal(&POOL.queued);
+	pthread_mutex_unlock(&POOL.lock);
+
+	return (object_t)future;
+}
+
+object_t touch(object_t obj)
+{
+	future_t future = to_future(obj);
+	if (! future)
+		return obj;
+
+	struct task* task = future->task;
+	if (task) {
+		pthread_mutex_lock(&POOL.lock);
+		bool claimed =
+			ROLE == POOL_THREAD && task->state == TASK_QUEUED;
+		if (claimed)
+			task->state = TASK_CLAIMED;
+		while (! claimed && task->state != TASK_DONE)
+			pthread_cond_wait(&POOL.done, &POOL.lock);
+		pthread_mutex_unlock(&POOL.lock);
+
+		object_t value;
+		if (claimed)
+			value = run_copy(task);
+		else
+			value = load_from_memory(task->result,
+						 task->result_size);
+
+		pthread_mutex_lock(&POOL.lock);
+		release_task(task);
+		pthread_mutex_unlock(&POOL.lock);
+
+		future->task = NULL;
+		write_barrier(obj, NULL, value);
+		future->value = value;
+	}
+
+	return future->value;
+}
+
+object_t native_future(int argct, object_t* args) // future
+{
+	assert_arg_count("future", argct, 1);
+	return spawn_task(args[0], wrap_nil(), false);
+}
+
+object_t native_touch(int argct, object_t* args) // touch
+{
+	assert_arg_count("touch", argct, 1);
+	return touch(args[0]);
+}
+
+//
+// `pmap` cuts the list into a few chunks per worker, so that each task is
+// big enough to be worth copying, and small enough to keep all the
+// workers busy until the end.
+//
+
+object_t native_pmap(int argct, object_t* args) // pmap
+{
+	assert_arg_count("pmap", argct, 2);
+	object_t func = args[0], seq = args[1], item;
+
+	start_future_pool();
+	int chunks = POOL.count * 4;
+	int size = (list_length(seq) + chunks - 1) / chunks;
+
+	struct array futures;
+	init_array(&futures);
+	while (to_pair(seq)) {
+		struct list_builder chunk = {NULL, NULL};
+		for (int i = 0; i < size && (item = pop_from_list(&seq)); i++)
+			append_to_builder(&chunk, item);
+
+		object_t items = finish_builder(&chunk, wrap_nil());
+		push_to_array(&futures, spawn_task(func, items, true));
+	}
+
+	struct list_builder builder = {NULL, NULL};
+	for (int i = 0; i < futures.size; i++) {
+		object_t values = touch(futures.data[i]), value;
+		object_t rest = values;
+		while ((value = pop_from_list(&rest)))
+			append_to_builder(&builder, value);
+	}
+
+	dispose_array(&futures);
+	return finish_builder(&builder, wrap_nil());
+}
 
 object_t native_modulo(int argct, object_t* args) // modulo
 {
 	assert_arg_count("modulo", argct, 2);
 	int a = unbox_int_or_die("modulo", args[0]);
 	int b = unbox_int_or_die("modulo", args[1]);
-	return wrap_int(a % b);
+	return arith_ints(ARITH_MODULO, a, b);
 }
 
 object_t native_num_divide(int argct, object_t* args) // /
@@ -3291,7 +8890,7 @@ object_t native_num_minus(int argct, object_t* args) // -
 	assert_arg_count("-", argct, 2);
 	int a = unbox_int_or_die("-", args[0]);
 	int b = unbox_int_or_die("-", args[1]);
-	return wrap_int(a - b);
+	return arith_ints(ARITH_MINUS, a, b);
 }
 
 object_t native_num_mult(int argct, object_t* args) // *
@@ -3299,14 +8898,17 @@ object_t native_num_mult(int argct, object_t* args) // *
 	assert_arg_count("*", argct, 2);
 	int a = unbox_int_or_die("*", args[0]);
 	int b = unbox_int_or_die("*", args[1]);
-	return wrap_int(a * b);
+	return arith_ints(ARITH_MULT, a, b);
 }
 
 object_t native_num_plus(int argct, object_t* args) // +
 {
 	int n = 0;
-	for (int i = 0; i < argct; i++)
-		n += unbox_int_or_die("+", args[i]);
+	for (int i = 0; i < argct; i++) {
+		int x = unbox_int_or_die("+", args[i]);
+		if (__builtin_add_overflow(n, x, &n))
+			DIE("Integer overflow in +");
+	}
 	return wrap_int(n);
 }
 
@@ -3320,6 +8922,7 @@ object_t native_setcdr(int argct, object_t* args) // set-cdr!
 {
 	assert_arg_count("set-cdr!", argct, 2);
 	pair_t pair = assert_pair(args[0], "as argument #1 of set-cdr!");
+	write_barrier(args[0], pair->cdr, args[1]);
 	pair->cdr = args[1];
 	return wrap_nil();
 }
@@ -3350,40 +8953,59 @@ int unbox_int_or_die(const char* name, object_t arg)
 	    typename(arg));
 }
 
-struct character;
+bool unbox_char(char*, object_t);
 
-char_t to_char(object_t);
-char unwrap_char(char_t);
+bool equal_leaves(object_t x, object_t y)
+{
+	type_t type = type_of(x);
+	if (type != type_of(y))
+		return false;
+	if (type == &TYPE_STRING) {
+		string_t a = (string_t)x, b = (string_t)y;
+		return (a->length == b->length) &&
+		       (memcmp(a->value, b->value, a->length) == 0);
+	}
+	return false;
+}
 
-bool eq(struct object* x, struct object* y)
+bool equal(object_t x, object_t y)
 {
-	while (true) {
+	if (x == y)
+		return true;
+
+	struct array work;
+	init_array(&work);
+	push_to_array(&work, x);
+	push_to_array(&work, y);
+
+	bool result = true;
+	while (result && work.size) {
+		y = pop_from_array(&work);
+		x = pop_from_array(&work);
 		if (x == y)
-			return true;
+			continue;
 
-		pair_t pair_x = to_pair(x);
-		pair_t pair_y = to_pair(y);
+		pair_t pair_x = to_pair(x), pair_y = to_pair(y);
+		vector_t vec_x = to_vector(x), vec_y = to_vector(y);
 		if (pair_x && pair_y) {
-			if (! eq(car(pair_x), car(pair_y)))
-				return false;
-			x = cdr(pair_x);
-			y = cdr(pair_y);
-			continue;
+			push_to_array(&work, cdr(pair_x));
+			push_to_array(&work, cdr(pair_y));
+			push_to_array(&work, car(pair_x));
+			push_to_array(&work, car(pair_y));
+		} else if (vec_x && vec_y) {
+			int size = vec_x->items.size;
+			result = (size == vec_y->items.size);
+			for (int i = size - 1; result && i >= 0; i--) {
+				push_to_array(&work, vec_x->items.data[i]);
+				push_to_array(&work, vec_y->items.data[i]);
+			}
+		} else {
+			result = equal_leaves(x, y);
 		}
-
-		symbol_t sx = to_symbol(x), sy = to_symbol(y);
-		if (sx && sy)
-			return strcmp(unwrap_symbol(sx), unwrap_symbol(sy)) ==
-			       0;
-
-		char_t cx = to_char(x), cy = to_char(y);
-		if (cx && cy)
-			return unwrap_char(cx) == unwrap_char(cy);
-
-		DIE("Don't know how to eq? %s against %s",
-		    typename(x),
-		    typename(y));
 	}
+
+	dispose_array(&work);
+	return result;
 }
 
 object_t syntax_cond(scope_t scope, object_t code) // cond
@@ -3393,63 +9015,57 @@ object_t syntax_cond(scope_t scope, object_t code) // cond
 	while ((clause = pop_from_list(&code))) {
 		test = pop_from_list_or_die(&clause);
 
-		bool flag;
-		if (is_symbol("else", test)) {
-			flag = true;
-		} else {
-			object_t result = eval_eager(scope, test);
-			flag = is_true(result);
-			decref(result);
-		}
-
-		if (flag)
+		if (is_symbol("else", test) || is_true(eval_eager(scope, test)))
 			return eval_block(scope, clause);
 	}
 	return wrap_nil();
 }
 
-object_t syntax_letrec(scope_t outer_scope, object_t code) // letrec
+object_t eval_let(scope_t scope, scope_t values, object_t code, bool rec)
 {
-	scope_t scope = derive_scope(outer_scope);
-
 	object_t bindings = pop_from_list_or_die(&code);
 	object_t binding;
 
 	while ((binding = pop_from_list(&bindings))) {
 		object_t keyobj = pop_from_list_or_die(&binding);
+		symbol_t key = assert_symbol(keyobj,
+					     rec ? "as `letrec` binding name"
+						 : "as `let` binding name");
 		object_t expr = pop_from_list_or_die(&binding);
-		symbol_t key =
-			assert_symbol(keyobj, "as `letrec` binding name");
-		object_t value = eval_eager(scope, expr);
+		object_t value = eval_eager(values, expr);
 		define(scope, key, value);
-		decref(value);
 	}
 
-	object_t result = eval_block(scope, code);
+	return eval_block(scope, code);
+}
 
-	decref((object_t)scope);
-	return result;
+object_t syntax_letrec(scope_t outer_scope, object_t code) // letrec
+{
+	scope_t scope = derive_scope(outer_scope);
+	return eval_let(scope, scope, code, true);
 }
 
 object_t syntax_let(scope_t outer_scope, object_t code) // let
 {
 	scope_t scope = derive_scope(outer_scope);
+	return eval_let(scope, outer_scope, code, false);
+}
 
-	object_t bindings = pop_from_list_or_die(&code);
-	object_t binding;
-
-	while ((binding = pop_from_list(&bindings))) {
-		object_t keyobj = pop_from_list_or_die(&binding);
-		symbol_t key = assert_symbol(keyobj, "as `let` binding name");
-		object_t expr = pop_from_list_or_die(&binding);
-		object_t value = eval_eager(outer_scope, expr);
-		define(scope, key, value);
-		decref(value);
-	}
-
-	object_t result = eval_block(scope, code);
+object_t syntax_stack_letrec(scope_t outer_scope, object_t code)
+{
+	struct scope scope;
+	enter_stack_scope(&scope, outer_scope);
+	object_t result = eval_let(&scope, &scope, code, true);
+	leave_stack_scope(&scope);
+	return result;
+}
 
-	decref((object_t)scope);
+object_t syntax_stack_let(scope_t outer_scope, object_t code)
+{
+	struct scope scope;
+	enter_stack_scope(&scope, outer_scope);
+	object_t result = eval_let(&scope, outer_scope, code, false);
+	leave_stack_scope(&scope);
 	return result;
 }
 
@@ -3461,10 +9077,12 @@ object_t syntax_lambda(scope_t scope, object_t code) // lambda
 
 bool unbox_int(int* ptr, object_t obj)
 {
-	if (obj->type != &TYPE_INT)
+	if (get_tag(obj) != TAG_INT)
 		return false;
-	integer_t num = (integer_t)obj;
-	*ptr = num->value;
+	intptr_t value = immediate_payload(obj);
+	if ((value < INT_MIN) || (value > INT_MAX))
+		return false;
+	*ptr = value;
 	return true;
 }
 
@@ -3474,8 +9092,6 @@ object_t syntax_letseq(scope_t scope, object_t code) // let*
 
 	object_t binding;
 
-	incref((object_t)scope);
-
 	while ((binding = pop_from_list(&bindings))) {
 		object_t key = pop_from_list_or_die(&binding);
 		symbol_t keysym = to_symbol(key);
@@ -3488,21 +9104,16 @@ object_t syntax_letseq(scope_t scope, object_t code) // let*
 
 		object_t value = eval_eager(scope, expr);
 		define(new_scope, keysym, value);
-		decref(value);
 
-		decref((object_t)scope);
 		scope = new_scope;
 	}
 
-	object_t result = eval_block(scope, code);
-
-	decref((object_t)scope);
-	return result;
+	return eval_block(scope, code);
 }
 
 string_t to_string(object_t obj)
 {
-	if (obj->type == &TYPE_STRING)
+	if (type_of(obj) == &TYPE_STRING)
 		return (string_t)obj;
 	return NULL;
 }
@@ -3527,9 +9138,42 @@ object_t native_open_input_file(int argct, object_t* args) // open-input-file
 	assert_arg_count("open-input-file", argct, 1);
 	string_t name = to_string_or_die("open-input-file", args[0]);
 	FILE* f = fopen_or_die(unwrap_string(name), "r");
+	setvbuf(f, NULL, _IOFBF, PORT_BUFFER);
 	return wrap_file(f);
 }
 
+//
+// String ports are ports over a memory stream. What's written so far
+// becomes visible in `buffer` and `size` once the stream is flushed.
+// They are also the only ports marked as `output`, so `display` and
+// `write` refuse the read-only ones.
+//
+
+object_t native_open_strport(int argct, object_t* args) // open-output-string
+{
+	assert_arg_count("open-output-string", argct, 0);
+	port_t port = (port_t)wrap_file(NULL);
+	port->value = open_memstream(&port->buffer, &port->size);
+	ASSERT(port->value, "Can't open a string port: %s", strerror(errno));
+	port->output = true;
+	fflush(port->value);
+	return (object_t)port;
+}
+
+object_t native_get_strport(int argct, object_t* args) // get-output-string
+{
+	assert_arg_count("get-output-string", argct, 1);
+	port_t port =
+		assert_port(args[0], "as an argument #1 of get-output-string");
+	ASSERT(port->buffer, "get-output-string needs a string port");
+
+	fflush(port->value);
+	char* text = malloc(port->size + 1);
+	ASSERT(text, "Out of memory");
+	memcpy(text, port->buffer, port->size + 1);
+	return wrap_owned_string(text, port->size);
+}
+
 object_t native_read_char(int argct, object_t* args) // read-char
 {
 	assert_arg_count("read-char", argct, 1);
@@ -3537,18 +9181,93 @@ object_t native_read_char(int argct, object_t* args) // read-char
 	FILE* f = unwrap_port(port);
 	int ch = fgetc_or_die(f);
 	if (ch == EOF)
-		return wrap_nil();
+		return wrap_eof();
 	else
 		return wrap_char(ch);
 }
 
+object_t native_read_line(int argct, object_t* args) // read-line
+{
+	assert_arg_count("read-line", argct, 1);
+	port_t port = assert_port(args[0], "as an argument #1 of read-line");
+	FILE* f = unwrap_port(port);
+
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length = getline(&line, &capacity, f);
+	if (length < 0) {
+		free(line);
+		if (ferror(f))
+			DIE("IO error: %s", strerror(errno));
+		return wrap_eof();
+	}
+
+	if ((length > 0) && (line[length - 1] == '\n'))
+		line[--length] = '\0';
+	return wrap_owned_string(line, length);
+}
+
+object_t native_read_string(int argct, object_t* args) // read-string
+{
+	assert_arg_count("read-string", argct, 2);
+	int count = unbox_int_or_die("read-string", args[0]);
+	port_t port = assert_port(args[1], "as an argument #2 of read-string");
+	FILE* f = unwrap_port(port);
+	ASSERT(count >= 0, "read-string needs a non-negative count");
+
+	// A count is only an upper bound, so the buffer grows as data arrives
+	struct text text = {NULL, 0, 0};
+	reserve_text(&text, (count < 4096 ? count : 4096) + 1);
+	while (text.length < count) {
+		if (text.length + 1 == text.capacity) {
+			long next = 2L * text.capacity;
+			if (next > count + 1L)
+				next = count + 1L;
+			reserve_text(&text, next);
+		}
+		int room = text.capacity - 1 - text.length;
+		size_t got = fread(text.data + text.length, 1, room, f);
+		if (got == 0)
+			break;
+		text.length += got;
+	}
+	if (ferror(f))
+		DIE("IO error: %s", strerror(errno));
+	if ((text.length == 0) && (count > 0)) {
+		free(text.data);
+		return wrap_eof();
+	}
+
+	text.data[text.length] = '\0';
+	return wrap_owned_string(text.data, text.length);
+}
+
+object_t native_read(int argct, object_t* args) // read
+{
+	assert_arg_count("read", argct, 1);
+	port_t port = assert_port(args[0], "as an argument #1 of read");
+	object_t result = read_object(unwrap_port(port));
+	return result ? result : wrap_eof();
+}
+
+object_t native_eof_object(int argct, object_t* args) // eof-object
+{
+	assert_arg_count("eof-object", argct, 0);
+	return wrap_eof();
+}
+
+object_t native_eof_objectp(int argct, object_t* args) // eof-object?
+{
+	assert_arg_count("eof-object?", argct, 1);
+	return wrap_bool(is_eof(args[0]));
+}
+
 object_t syntax_or(scope_t scope, object_t code) // or
 {
 	object_t expr;
 	object_t value = wrap_bool(false);
 
 	while ((expr = pop_from_list(&code))) {
-		decref(value);
 		value = eval_eager(scope, expr);
 		if (is_true(value))
 			break;
@@ -3562,7 +9281,6 @@ object_t syntax_and(scope_t scope, object_t code) // and
 	object_t value = wrap_bool(true);
 
 	while ((expr = pop_from_list(&code))) {
-		decref(value);
 		value = eval_eager(scope, expr);
 		if (is_false(value))
 			break;
@@ -3571,17 +9289,18 @@ object_t syntax_and(scope_t scope, object_t code) // and
 	return value;
 }
 
-char_t to_char(object_t obj)
+bool unbox_char(char* ptr, object_t obj)
 {
-	if (obj->type == &TYPE_CHAR)
-		return (char_t)obj;
-	return NULL;
+	if (get_tag(obj) != TAG_CHAR)
+		return false;
+	*ptr = immediate_payload(obj);
+	return true;
 }
 
-char_t to_char_or_die(const char* name, object_t obj)
+char unbox_char_or_die(const char* name, object_t obj)
 {
-	char_t ch = to_char(obj);
-	if (! ch) {
+	char ch;
+	if (! unbox_char(&ch, obj)) {
 		DIE("Expected argument of %s to be a character, got %s instead",
 		    name,
 		    typename(obj));
@@ -3589,44 +9308,30 @@ char_t to_char_or_die(const char* name, object_t obj)
 	return ch;
 }
 
-char unwrap_char(char_t ch)
-{
-	return ch->value;
-}
-
 object_t native_list_to_string(int argct, object_t* args) // list->string
 {
 	assert_arg_count("list->string", argct, 1);
 	object_t list = args[0], obj;
-	char buffer[10240];
-	int fill = 0;
+	int length = list_length(list);
+	string_t str = alloc_string(&TYPE_STRING, length > 0 ? length : 0);
 
 	while ((obj = pop_from_list(&list))) {
-		if (fill >= 10240)
-			DIE("Buffer overflow");
-		char_t ch = to_char_or_die("list->string", obj);
-		buffer[fill++] = unwrap_char(ch);
+		char ch = unbox_char_or_die("list->string", obj);
+		append_to_string(str, &ch, 1);
 	}
-	buffer[fill++] = '\0';
 
-	return wrap_string(buffer);
+	return (object_t)str;
 }
 
 object_t native_string_to_list(int argct, object_t* args) // string->list
 {
 	assert_arg_count("string->list", argct, 1);
 	string_t str = to_string_or_die("string->list", args[0]);
-	const char* text = unwrap_string(str);
-
-	object_t acc = wrap_nil();
-	while (*text) {
-		object_t ch = wrap_char(*text);
-		push_to_list(&acc, ch);
-		decref(ch);
-		text++;
-	}
-	object_t result = reverse(acc);
-	decref(acc);
+	object_t result = wrap_nil();
+	for (int i = str->length - 1; i >= 0; i--) {
+		object_t ch = wrap_char(str->value[i]);
+		push_to_list(&result, ch);
+	}
 	return result;
 }
 
@@ -3637,9 +9342,9 @@ object_t native_string_equal(int argct, object_t* args) // string=?
 	string_t b = to_string(args[1]);
 
 	if (a && b) {
-		const char* sa = unwrap_string(a);
-		const char* sb = unwrap_string(b);
-		return wrap_bool(strcmp(sa, sb) == 0);
+		bool same = (a->length == b->length) &&
+			    (memcmp(a->value, b->value, a->length) == 0);
+		return wrap_bool(same);
 	}
 
 	return wrap_bool(false);
@@ -3649,8 +9354,7 @@ object_t native_string_length(int argct, object_t* args) // string-length
 {
 	assert_arg_count("string-length", argct, 1);
 	string_t obj = to_string_or_die("string-length", args[0]);
-	const char* str = unwrap_string(obj);
-	return wrap_int(strlen(str));
+	return wrap_int(obj->length);
 }
 
 object_t native_string_ref(int argct, object_t* args) // string-ref
@@ -3665,13 +9369,24 @@ object_t native_string_ref(int argct, object_t* args) // string-ref
 void set_in_scope(scope_t scope, symbol_t key, object_t value)
 {
 	while (scope) {
-		object_t old_value = lookup_in_dict(&scope->binds, key);
-		if (old_value) {
-			put_in_dict(&scope->binds, key, value);
-			if (! scope->parent) {
-				incref(value);
-				decref(old_value);
+		if (scope->template) {
+			object_t* slot = find_slot(scope, key);
+			if (slot && *slot) {
+				write_barrier((object_t)scope, *slot, value);
+				*slot = value;
+				return;
 			}
+			scope = scope->parent;
+			continue;
+		}
+
+		// Not put_in_dict(), which may move the entries around
+		dict_entry_t entry = find_in_dict(&scope->binds, key);
+		if (entry) {
+			write_barrier((object_t)scope, entry->value, value);
+			entry->value = value;
+			if (! scope->parent)
+				GLOBAL_SETS++;
 			return;
 		}
 		scope = scope->parent;
@@ -3686,7 +9401,6 @@ object_t syntax_set(scope_t scope, object_t code) // set!
 	object_t expr = pop_from_list_or_die(&code);
 	object_t value = eval_eager(scope, expr);
 	set_in_scope(scope, key, value);
-	decref(value);
 	return wrap_nil();
 }
 
@@ -3695,9 +9409,8 @@ object_t native_string_set(int argct, object_t* args) // string-set!
 	assert_arg_count("string-set!", argct, 3);
 	string_t str = to_string_or_die("string-set!", args[0]);
 	int index = unbox_int_or_die("string-set!", args[1]);
-	char_t ch = to_char_or_die("string-set!", args[2]);
-	str->value[index - 1] = ch->value;
-	incref(args[0]);
+	char ch = unbox_char_or_die("string-set!", args[2]);
+	str->value[index - 1] = ch;
 	return args[0];
 }
 
@@ -3709,8 +9422,17 @@ object_t native_not(int argct, object_t* args) // not
 
 object_t native_display(int argct, object_t* args) // display
 {
+	FILE* out = current_output();
+	port_t port = argct > 1 ? to_port(args[argct - 1]) : NULL;
+	if (port) {
+		port = assert_output_port(args[argct - 1],
+					  "as the last argument of display");
+		out = unwrap_port(port);
+		argct--;
+	}
+
 	for (int i = 0; i < argct; i++)
-		display_object(stdout, args[i]);
+		display_object(out, args[i]);
 	return wrap_nil();
 }
 
@@ -3718,76 +9440,278 @@ object_t native_string_copy(int argct, object_t* args) // string-copy
 {
 	assert_arg_count("string-copy", argct, 1);
 	string_t str = to_string_or_die("string-copy", args[0]);
-	return wrap_string(unwrap_string(str));
+	string_t copy = alloc_string(&TYPE_STRING, str->length);
+	append_to_string(copy, str->value, str->length);
+	return (object_t)copy;
 }
 
 object_t native_string_append(int argct, object_t* args) // string-append
 {
-	char buffer[10240];
-	int fill = 0;
+	int length = 0;
+	for (int i = 0; i < argct; i++)
+		length += to_string_or_die("string-append", args[i])->length;
+
+	string_t result = alloc_string(&TYPE_STRING, length);
 	for (int i = 0; i < argct; i++) {
-		string_t strobj = to_string_or_die("string-append", args[i]);
-		const char* str = unwrap_string(strobj);
-		while (*str) {
-			if (fill >= 10239)
-				DIE("Buffer overflow");
-			buffer[fill++] = *(str++);
-		}
+		string_t str = (string_t)args[i];
+		append_to_string(result, str->value, str->length);
 	}
-	buffer[fill] = '\0';
-	return wrap_string(buffer);
+	return (object_t)result;
 }
 
 object_t native_substring(int argct, object_t* args) // substring
 {
-	assert_arg_count("string-copy", argct, 3);
-	string_t strobj = to_string_or_die("substring", args[0]);
-	const char* str = unwrap_string(strobj);
+	assert_arg_count("substring", argct, 3);
+	string_t str = to_string_or_die("substring", args[0]);
 	int start = unbox_int_or_die("substring", args[1]);
 	int end = unbox_int_or_die("substring", args[2]);
-	char buffer[10240];
-	int fill = 0;
+	if ((start < 0) || (end > str->length) || (start > end))
+		DIE("substring %d..%d is out of range", start, end);
+
+	string_t result = alloc_string(&TYPE_STRING, end - start);
+	append_to_string(result, str->value + start, end - start);
+	return (object_t)result;
+}
+
+object_t native_make_sb(int argct, object_t* args) // make-string-builder
+{
+	assert_arg_count("make-string-builder", argct, 0);
+	return (object_t)alloc_string(&TYPE_STRING_BUILDER, 16);
+}
 
-	for (int i = start; i < end; i++) {
-		if (fill >= 10239)
-			DIE("Buffer overflow");
-		buffer[fill++] = str[i];
+string_t assert_string_builder(object_t obj, const char* context)
+{
+	if (type_of(obj) == &TYPE_STRING_BUILDER)
+		return (string_t)obj;
+	DIE("Expected a string builder %s, got %s instead",
+	    context,
+	    typename(obj));
+}
+
+object_t native_sb_append(int argct, object_t* args) // string-builder-append!
+{
+	assert_vararg_count("string-builder-append!", argct, 1, INT_MAX);
+	string_t builder = assert_string_builder(
+		args[0], "as argument #1 of string-builder-append!");
+
+	char ch;
+	for (int i = 1; i < argct; i++) {
+		string_t str = to_string(args[i]);
+		if (str)
+			append_to_string(builder, str->value, str->length);
+		else if (unbox_char(&ch, args[i]))
+			append_to_string(builder, &ch, 1);
+		else
+			DIE("Can't append %s to a string builder",
+			    typename(args[i]));
 	}
-	buffer[fill] = '\0';
-	return wrap_string(buffer);
+
+	return args[0];
 }
 
-object_t reverse(object_t list)
+// Hands the builder's buffer to the new string without copying, so the
+// builder is reset to empty and can be reused for the next string.
+object_t native_sb_string(int argct, object_t* args) // string-builder->string
 {
-	object_t result = wrap_nil(), obj;
+	assert_arg_count("string-builder->string", argct, 1);
+	string_t builder = assert_string_builder(
+		args[0], "as argument #1 of string-builder->string");
+
+	string_t result = alloc_object(&TYPE_STRING, sizeof(*result));
+	result->value = builder->value;
+	result->length = builder->length;
+	result->capacity = builder->capacity;
+
+	builder->value = malloc(17);
+	ASSERT(builder->value, "Out of memory");
+	builder->value[0] = '\0';
+	builder->length = 0;
+	builder->capacity = 16;
+	return (object_t)result;
+}
+
+vector_t assert_vector(object_t obj, const char* context)
+{
+	vector_t vector = to_vector(obj);
+	if (vector)
+		return vector;
+	DIE("Expected a vector %s, got %s instead", context, typename(obj));
+}
+
+object_t* vector_slot(vector_t vector, object_t index, const char* name)
+{
+	int at = unbox_int_or_die(name, index);
+	if ((at < 0) || (at >= vector->items.size))
+		DIE("Index %d is out of range in %s", at, name);
+	return &vector->items.data[at];
+}
+
+object_t native_make_vector(int argct, object_t* args) // make-vector
+{
+	assert_vararg_count("make-vector", argct, 1, 2);
+	int size = unbox_int_or_die("make-vector", args[0]);
+	ASSERT(size >= 0, "make-vector can't make a vector of size %d", size);
+	object_t fill = (argct == 2) ? args[1] : wrap_bool(false);
+	return (object_t)wrap_vector(size, fill);
+}
+
+object_t native_vector_ref(int argct, object_t* args) // vector-ref
+{
+	assert_arg_count("vector-ref", argct, 2);
+	vector_t vector =
+		assert_vector(args[0], "as argument #1 of vector-ref");
+	return *vector_slot(vector, args[1], "vector-ref");
+}
+
+object_t native_vector_set(int argct, object_t* args) // vector-set!
+{
+	assert_arg_count("vector-set!", argct, 3);
+	vector_t vector =
+		assert_vector(args[0], "as argument #1 of vector-set!");
+	object_t* slot = vector_slot(vector, args[1], "vector-set!");
+	write_barrier(args[0], *slot, args[2]);
+	*slot = args[2];
+	return wrap_nil();
+}
+
+object_t native_vector_length(int argct, object_t* args) // vector-length
+{
+	assert_arg_count("vector-length", argct, 1);
+	vector_t vector =
+		assert_vector(args[0], "as argument #1 of vector-length");
+	return wrap_int(vector->items.size);
+}
 
+object_t native_list_to_vector(int argct, object_t* args) // list->vector
+{
+	assert_arg_count("list->vector", argct, 1);
+	object_t list = args[0], obj;
+
+	vector_t vector = wrap_vector(0, NULL);
 	while ((obj = pop_from_list(&list)))
-		push_to_list(&result, obj);
+		push_to_array(&vector->items, obj);
+	return (object_t)vector;
+}
+
+object_t native_vector_to_list(int argct, object_t* args) // vector->list
+{
+	assert_arg_count("vector->list", argct, 1);
+	vector_t vector =
+		assert_vector(args[0], "as argument #1 of vector->list");
 
+	object_t result = wrap_nil();
+	for (int i = vector->items.size - 1; i >= 0; i--)
+		push_to_list(&result, vector->items.data[i]);
 	return result;
 }
 
-//
+table_t assert_table(object_t obj, const char* context)
+{
+	table_t table = to_table(obj);
+	if (table)
+		return table;
+	DIE("Expected a hash table %s, got %s instead", context, typename(obj));
+}
+
+object_t native_make_table(int argct, object_t* args) // make-hash-table
+{
+	assert_arg_count("make-hash-table", argct, 0);
+	table_t table = alloc_object(&TYPE_TABLE, sizeof(*table));
+	init_slots(&table->live, 8);
+	return (object_t)table;
+}
 
-void decref_many(int argct, object_t* args);
+object_t native_table_ref(int argct, object_t* args) // hash-table-ref
+{
+	assert_vararg_count("hash-table-ref", argct, 2, 3);
+	table_t table =
+		assert_table(args[0], "as argument #1 of hash-table-ref");
 
-//
+	move_entries(table, 1);
+	struct table_entry* entry = find_in_table(table, args[1]);
+	object_t result = entry ? entry->value : NULL;
+	if (! result && argct == 3)
+		result = args[2];
+	if (! result) {
+		DEBUG("key", args[1]);
+		DIE("Key not found in hash-table-ref");
+	}
+
+	return result;
+}
+
+object_t native_table_set(int argct, object_t* args) // hash-table-set!
+{
+	assert_arg_count("hash-table-set!", argct, 3);
+	table_t table =
+		assert_table(args[0], "as argument #1 of hash-table-set!");
+	object_t key = args[1], value = args[2];
+
+	move_entries(table, 2);
+	unsigned int hash = hash_key(key);
+	struct table_entry* entry = find_in_slots(&table->live, key, hash);
+	if (entry) {
+		write_barrier(args[0], entry->value, value);
+		entry->value = value;
+		return wrap_nil();
+	}
+
+	entry = find_in_slots(&table->old, key, hash);
+	if (entry)
+		remove_from_slots(&table->old, entry);
+
+	make_room_in_table(table);
+	write_barrier(args[0], NULL, key);
+	write_barrier(args[0], NULL, value);
+	struct table_entry item = {.key = key, .value = value, .hash = hash};
+	put_in_slots(&table->live, item);
+	return wrap_nil();
+}
+
+object_t native_table_delete(int argct, object_t* args) // hash-table-delete!
+{
+	assert_arg_count("hash-table-delete!", argct, 2);
+	table_t table =
+		assert_table(args[0], "as argument #1 of hash-table-delete!");
+
+	move_entries(table, 2);
+	unsigned int hash = hash_key(args[1]);
+	struct table_entry* entry;
+	if ((entry = find_in_slots(&table->live, args[1], hash)))
+		remove_from_slots(&table->live, entry);
+	else if ((entry = find_in_slots(&table->old, args[1], hash)))
+		remove_from_slots(&table->old, entry);
+	return wrap_nil();
+}
+
+object_t native_table_count(int argct, object_t* args) // hash-table-count
+{
+	assert_arg_count("hash-table-count", argct, 1);
+	table_t table =
+		assert_table(args[0], "as argument #1 of hash-table-count");
+	return wrap_int(table->live.used + table->old.used);
+}
 
-void array_decref(array_t arr)
+object_t reverse(object_t list)
 {
-	decref_many(arr->size, (object_t*)arr->data);
+	object_t result = wrap_nil(), obj;
+
+	while ((obj = pop_from_list(&list)))
+		push_to_list(&result, obj);
+
+	return result;
 }
 
 native_t to_native(object_t obj)
 {
-	if (obj->type == &TYPE_NATIVE)
+	if (type_of(obj) == &TYPE_NATIVE)
 		return (native_t)obj;
 	return NULL;
 }
 
 syntax_t to_syntax(object_t obj)
 {
-	if (obj->type == &TYPE_SYNTAX)
+	if (type_of(obj) == &TYPE_SYNTAX)
 		return (syntax_t)obj;
 	return NULL;
 }
@@ -3845,4 +9769,39 @@ void register_builtins(void)
 	register_native("string-append", native_string_append);
 	register_native("string=?", native_string_equal);
 	register_native("fold", native_fold);
+	register_native("pool-stats", native_pool_stats);
+	register_native("gc-stats", native_gc_stats);
+	register_native("make-string-builder", native_make_sb);
+	register_native("string-builder-append!", native_sb_append);
+	register_native("string-builder->string", native_sb_string);
+	register_native("make-vector", native_make_vector);
+	register_native("vector-ref", native_vector_ref);
+	register_native("vector-set!", native_vector_set);
+	register_native("vector-length", native_vector_length);
+	register_native("list->vector", native_list_to_vector);
+	register_native("vector->list", native_vector_to_list);
+	register_native("make-hash-table", native_make_table);
+	register_native("hash-table-ref", native_table_ref);
+	register_native("hash-table-set!", native_table_set);
+	register_native("hash-table-delete!", native_table_delete);
+	register_native("hash-table-count", native_table_count);
+	register_native("map", native_map);
+	register_native("filter", native_filter);
+	register_native("append", native_append);
+	register_native("length", native_length);
+	register_native("list-tail", native_list_tail);
+	register_native("equal?", native_equalp);
+	register_native("profile-start", native_profile_start);
+	register_native("profile-report", native_profile_report);
+	register_native("future", native_future);
+	register_native("touch", native_touch);
+	register_native("pmap", native_pmap);
+	register_native("open-output-string", native_open_strport);
+	register_native("get-output-string", native_get_strport);
+	register_native("read-line", native_read_line);
+	register_native("read-string", native_read_string);
+	register_native("read", native_read);
+	register_native("eof-object", native_eof_object);
+	register_native("eof-object?", native_eof_objectp);
+	register_native("apply", native_apply);
 }
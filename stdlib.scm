@@ -22,24 +22,11 @@
 ;(define (length xs)
 ;	(fold (lambda (ct x) (+ ct 1)) 0 xs))
 
-(define (append xs ys)
-	(reverse
-		(fold
-			(lambda (acc x) (cons x acc))
-			(reverse xs)
-			ys)))
-
 ; (define (reverse xs)
 ;	(fold (lambda (tail x) (cons x tail)) '() xs))
 	
-(define (map f xs)
-	(fold-list xs
-		(lambda (acc x) (cons (f x) acc))))
-
 (define (writeln x)
 	(write x)
 	(newline))
 
-(define eof-object? null?)
-
 (define (> a b) (< b a))
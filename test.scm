@@ -14,3 +14,180 @@
 (define (baz x y z) (and x y z))
 (writeln (baz #f #f 1))
 (writeln baz)
+
+(define (twice x) (* 2 x))
+(define (use-twice) (twice 5))
+(writeln (use-twice))
+(define (twice x) (* 3 x))
+(writeln (use-twice))
+
+(define counter 0)
+(define (count-to n)
+  (set! counter (+ counter 1))
+  (if (= n 0) counter (count-to (- n 1))))
+(writeln (count-to 1000))
+(define (greet) 'hello)
+(define (call-greet) (greet))
+(writeln (call-greet))
+(set! greet (lambda () 'bye))
+(writeln (call-greet))
+
+(define sb (make-string-builder))
+(string-builder-append! sb "abc" #\- "def")
+(writeln (string-builder->string sb))
+(writeln (string-builder->string sb))
+(define (fill-builder n)
+  (if (= n 0)
+      sb
+      (let ((ignored (string-builder-append! sb "0123456789")))
+        (fill-builder (- n 1)))))
+(define digits (string-builder->string (fill-builder 10)))
+(writeln (string-length digits))
+(writeln (substring digits 95 100))
+(writeln (string-append "foo" "" "bar"))
+(writeln (string-length (string-append)))
+
+(define v (make-vector 3))
+(writeln v)
+(vector-set! v 0 'a)
+(vector-set! v 2 (list 1 2))
+(writeln v)
+(writeln (vector-ref v 2))
+(writeln (vector-length (make-vector 0 1)))
+(writeln (vector->list (list->vector (list 1 2 3))))
+(writeln (list->vector (list)))
+(writeln (make-vector 2 "x"))
+
+(define h (make-hash-table))
+(hash-table-set! h 'one 1)
+(hash-table-set! h "two" 2)
+(hash-table-set! h 3 'three)
+(writeln (hash-table-ref h 'one))
+(writeln (hash-table-ref h (string-append "t" "wo")))
+(writeln (hash-table-ref h 3))
+(writeln (hash-table-ref h 'four 'none))
+(hash-table-set! h 'one 'uno)
+(writeln (hash-table-ref h 'one))
+(hash-table-delete! h "two")
+(writeln (hash-table-ref h "two" #f))
+(writeln (hash-table-count h))
+(define (fill-table n)
+  (if (< n 1000)
+      (let ((ignored (hash-table-set! h n (* n n))))
+        (if (= (hash-table-ref h 10) 100) (fill-table (+ n 1)) n))
+      (hash-table-count h)))
+(writeln (fill-table 10))
+(define (check-table n)
+  (if (< n 1000)
+      (if (= (hash-table-ref h n) (* n n)) (check-table (+ n 1)) n)
+      'all-found))
+(writeln (check-table 10))
+(define (drain-table n)
+  (if (< n 1000)
+      (let ((ignored (hash-table-delete! h n)))
+        (drain-table (+ n 2)))
+      (hash-table-count h)))
+(writeln (drain-table 10))
+(writeln (hash-table-ref h 11))
+(writeln (hash-table-ref h 12 'gone))
+
+(define (square x) (* x x))
+(writeln (map square (list 1 2 3)))
+(writeln (map square (list)))
+(writeln (filter pair? (list 1 (list 2) 3 (list 4 5))))
+(writeln (filter pair? (list)))
+(writeln (append (list 1 2) (list) (list 3) (list 4 5)))
+(writeln (append))
+(writeln (append (list 1) 2))
+(writeln (length (list 1 2 3)))
+(writeln (length (list)))
+(writeln (list-tail (list 1 2 3 4) 2))
+(writeln (list-tail (list 1 2) 2))
+(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))
+(define long (iota 100000 (list)))
+(writeln (length (map list long)))
+(writeln (car (list-tail (filter pair? (map list long)) 99999)))
+(writeln (length (append long long)))
+
+(writeln (eq? 'a 'a))
+(writeln (eq? (list 1) (list 1)))
+(writeln (equal? (list 1 (list 2 "three") #\4) (list 1 (list 2 "three") #\4)))
+(writeln (equal? (list 1 2) (list 1 2 3)))
+(writeln (equal? "abc" "abd"))
+(writeln (equal? (cons 1 2) (cons 1 2)))
+(writeln (equal? (list->vector (list 1 "x")) (list->vector (list 1 "x"))))
+(writeln (equal? (list) (list)))
+(writeln (equal? long (map car (map list long))))
+(writeln (equal? long (append (list-tail long 1) (list 1))))
+(define (nest n acc) (if (= n 0) acc (nest (- n 1) (list acc))))
+(writeln (equal? (nest 100000 'x) (nest 100000 'x)))
+(writeln (equal? (nest 100000 'x) (nest 100000 'y)))
+
+(define out (open-output-string))
+(writeln (string-length (get-output-string out)))
+(display "abc" out)
+(display 42 out)
+(writeln (get-output-string out))
+(display #\! out)
+(writeln (get-output-string out))
+(define (copy-chars in out)
+  (let ((ch (read-char in)))
+    (if (eof-object? ch)
+        out
+        (let ((ignored (display ch out)))
+          (copy-chars in out)))))
+(define with-nuls
+  (get-output-string
+   (copy-chars (open-input-file "test/nul.txt") (open-output-string))))
+(writeln (string-length with-nuls))
+(writeln (string-ref with-nuls 5))
+(writeln (string=? (substring with-nuls 1 2) (substring with-nuls 3 4)))
+(writeln (string=? (substring with-nuls 0 2) "a"))
+(writeln (string-length (string-append with-nuls with-nuls)))
+(define p (open-input-file "test/long.txt"))
+(writeln (string-length (read p)))
+(define long-name (open-output-string))
+(display (read p) long-name)
+(writeln (string-length (get-output-string long-name)))
+(writeln (eof-object? (read p)))
+(writeln (string-length (read-line (open-input-file "test/long.txt"))))
+(writeln (string-length (read-string 100000 (open-input-file "test/long.txt"))))
+(define e (open-input-file "test/empty.txt"))
+(writeln (read-string 0 e))
+(writeln (eof-object? (read-string 5 e)))
+(writeln (eof-object? (read-line e)))
+(writeln (eof-object? (read e)))
+(define n (open-input-file "test/nul.txt"))
+(define s (read-string 3 n))
+(writeln (string-length s))
+(writeln (string=? (substring s 1 2) (substring with-nuls 1 2)))
+(writeln (string-length (read-line n)))
+(writeln (eof-object? (read-line n)))
+(writeln (read (open-input-file "test/nul.txt")))
+(define l (open-input-file "test/nil.txt"))
+(define first-read (read l))
+(writeln (list (null? first-read) (eof-object? first-read)))
+(define last-read (read l))
+(writeln (list (null? last-read) (eof-object? last-read)))
+(writeln (null? (read-char e)))
+(writeln (eof-object))
+(define (count-args . args) (length args))
+(writeln (count-args))
+(writeln (count-args 1 2 3))
+(define (first-and-rest first . rest) (list first rest))
+(writeln (first-and-rest 1))
+(writeln (first-and-rest 1 2 3))
+(define (rest-loop n . acc)
+  (if (= n 0) (length acc) (rest-loop (- n 1) n n)))
+(writeln (rest-loop 100000))
+(define (nothing) 'nothing)
+(define (call-nothing n) (if (= n 0) (nothing) (call-nothing (- n 1))))
+(writeln (call-nothing 10))
+(define long-list (iota 100000 '()))
+(writeln (apply count-args long-list))
+(writeln (apply + (iota 1000 '())))
+(writeln (car (car (cdr (apply first-and-rest 0 long-list)))))
+(writeln (length (car (cdr (apply first-and-rest 0 long-list)))))
+(define (apply-loop n) (if (= n 0) 'done (apply apply-loop (list (- n 1)))))
+(writeln (apply-loop 100000))
+(writeln (eq? (car (cdr (apply first-and-rest long-list))) (cdr long-list)))
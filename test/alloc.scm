@@ -0,0 +1,10 @@
+(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))
+(define (churn n)
+  (if (= n 0) 'done (churn (- n (/ (length (iota 1000 '())) 1000)))))
+(writeln (churn 200))
+(define (in-use? row)
+  (and (> (car (cdr row)) 0) (not (< (car (cdr (cdr row))) (car (cdr row))))))
+(define (all-in-use? rows)
+  (if (null? rows) #t (and (in-use? (car rows)) (all-in-use? (cdr rows)))))
+(writeln (null? (pool-stats)))
+(writeln (all-in-use? (pool-stats)))
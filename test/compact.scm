@@ -0,0 +1,17 @@
+(define (stat name stats)
+  (if (eq? (car (car stats)) name)
+      (cdr (car stats))
+      (stat name (cdr stats))))
+
+(define (compactions) (stat 'compactions (gc-stats)))
+
+(define (build n acc)
+  (if (= n 0) acc (build (- n 1) (cons n acc))))
+
+(define (churn start rounds kept)
+  (if (or (= rounds 0) (> (compactions) start))
+      (writeln (list (> (compactions) start)
+                     (= (length kept) (* 1000 (- 1000 rounds)))))
+      (churn start (- rounds 1) (build 1000 kept))))
+
+(churn (compactions) 1000 '())
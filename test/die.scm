@@ -0,0 +1,4 @@
+(writeln 'before)
+(define (deep n) (let ((x n)) (if (= n 0) (car x) (+ 1 (deep (- n 1))))))
+(writeln (deep 50))
+(writeln 'after)
@@ -0,0 +1,11 @@
+(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))
+(define (square x) (* x x))
+(define (count-up n) (if (= n 0) 0 (+ 1 (count-up (- n 1)))))
+(writeln (touch (future (lambda () (square 12)))))
+(writeln (touch 5))
+(define squares (map (lambda (n) (future (lambda () (square n)))) (iota 10 '())))
+(writeln (map touch squares))
+(writeln (touch (future (lambda () (touch (future (lambda () 'nested)))))))
+(writeln (pmap square (iota 100 '())))
+(writeln (pmap count-up '(3000 1 2000 2 1000 3)))
+(writeln (pmap square '()))
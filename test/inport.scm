@@ -0,0 +1,4 @@
+(define in (open-input-file "test/empty.txt"))
+(writeln (quote before))
+(display "lost" in)
+(writeln (quote after))
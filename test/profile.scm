@@ -0,0 +1,7 @@
+(define (leaf) (cons 1 2) 'leaf)
+(define (branch) (leaf) (leaf) 'branch)
+(define (countdown n) (if (= n 0) (leaf) (begin-countdown n)))
+(define (begin-countdown n) (cons n n) (countdown (- n 1)) 'done)
+(define (handoff) (cons 0 0) (branch))
+(define (root) (branch) (leaf) (countdown 3) (handoff) 'root)
+(root)
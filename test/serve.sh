@@ -0,0 +1,48 @@
+#!/bin/sh
+# Starts a --serve server in the background, runs a few scripts through
+# --connect and checks what comes back: the output the script wrote to
+# the client's own stdout, and its exit status, for one that dies as well.
+# The server gets killed however the checks go.
+#
+# usage: test/serve.sh [scheme binary]
+
+SCHEME=${1:-./scheme}
+TEMP=${TEMP_DIR:-temp}
+SOCKET="$TEMP/serve.sock"
+
+mkdir -p "$TEMP"
+rm -f "$SOCKET"
+"$SCHEME" --serve="$SOCKET" &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null; rm -f "$SOCKET"' EXIT
+
+tries=0
+while [ ! -S "$SOCKET" ]; do
+	tries=$((tries + 1))
+	if [ $tries -gt 100 ] || ! kill -0 $SERVER 2> /dev/null; then
+		echo "server didn't come up" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+fail() {
+	echo "serve: $*" >&2
+	exit 1
+}
+
+"$SCHEME" --connect="$SOCKET" pro99.scm > "$TEMP/output" ||
+	fail "pro99.scm exited with $?"
+diff "$TEMP/output" test/pro99.out || fail "pro99.scm output differs"
+
+echo "(writeln 'piped)" | "$SCHEME" --connect="$SOCKET" > "$TEMP/output" ||
+	fail "stdin script exited with $?"
+echo piped | diff "$TEMP/output" - || fail "stdin script output differs"
+
+"$SCHEME" --connect="$SOCKET" test/die.scm > "$TEMP/output" 2> /dev/null
+[ $? -ne 0 ] || fail "test/die.scm exited with 0"
+diff "$TEMP/output" test/die.out || fail "test/die.scm output differs"
+
+"$SCHEME" --connect="$SOCKET" pro99.scm > "$TEMP/output" ||
+	fail "pro99.scm after a dead script exited with $?"
+diff "$TEMP/output" test/pro99.out || fail "pro99.scm output differs"
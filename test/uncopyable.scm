@@ -0,0 +1,5 @@
+(define table (make-hash-table))
+(define (peek) (hash-table-count table))
+(writeln 'before)
+(future peek)
+(writeln 'after)